@@ -26,6 +26,10 @@
  *         |   kernel   |
  *  32 MiB +------------+
  *         |            |
+ *         |............|
+ *         |worker stack|
+ *         |............|
+ *         | mmu table  |
  *  31 MiB +------------+
  *         | irq stack  |
  *  30 MiB +------------+
@@ -36,16 +40,23 @@
  *         | bootloader |
  *   8 KiB +------------+
  *         |            |
+ *   4 KiB +------------+
+ *         |  park spin |
+ *         |............|
+ *         | arm stub / |
+ *         |vector table|
  * 0 bytes +------------+
  */
 #ifndef ADDRMAP_H
 #define ADDRMAP_H
 
 /*
- * The heap starts at 256 MiB and is expected to be
- * grown upwards. 
+ * The heap starts at 256 MiB and is grown upwards, up to 1 GiB:
+ * the end of the RAM mapped by the MMU, and as far as the host
+ * controller's DMA can reach.
  */
-#define HEAP_RAM_ADDR 0x10000000
+#define HEAP_RAM_ADDR     0x10000000
+#define HEAP_END_RAM_ADDR 0x40000000
 
 /* Addresses in RAM that the kernel / device tree blob are loaded to. */
 #define DTB_RAM_ADDR  0x8000000  /* 128 MiB. */
@@ -59,4 +70,25 @@
 #define IRQ_STACK_START_ADDR 0x1f00000  /* 31 MiB. */
 #define SVC_STACK_START_ADDR 0x1e00000  /* 30 MiB. */
 
+/* 
+ * Address of the MMU's 16 KiB first level translation table, which 
+ * must be 16 KiB aligned.
+ */
+#define MMU_TABLE_ADDR 0x1f00000  /* 31 MiB. */
+
+/*
+ * Where the stacks of the secondary cores (cores 1 to 3) used as workers start.
+ * Core n's stack starts at WORKER_STACKS_ADDR+n*WORKER_STACK_SZ and grows 
+ * downwards, so core 1's stack sits right above this address.
+ */
+#define WORKER_STACKS_ADDR 0x1f10000  /* 31 MiB + 64 KiB. */
+#define WORKER_STACK_SZ    0x10000    /* 64 KiB. */
+
+/*
+ * Address the secondary cores' park spin loop is copied to once they're done
+ * as workers, in the first 4 KiB of RAM after the ARM stub, which the device 
+ * tree reserves, so that the kernel doesn't trample it before releasing them.
+ */
+#define PARK_RAM_ADDR 0xf00
+
 #endif
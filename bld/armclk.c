@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2023 Petar Turukalo
+ * SPDX-License-Identifier: GPL-2.0
+ */
+#include "armclk.h"
+#include "tag.h"
+#include "debug.h"
+
+/*
+ * How far below the temperature the firmware throttles at, in thousandths of a 
+ * degree Celsius, that the SoC can get to before the boost is dropped. Leaves 
+ * the firmware's own throttling to the kernel.
+ */
+#define ARMCLK_TEMP_MARGIN 5000
+
+static struct {
+	uint32_t orig_rate;  /**< Rate before the boost, in Hz. */
+	bool boosted;
+} armclk;
+
+/** @brief Whether the SoC is too hot or throttled for the ARM clock to be boosted. */
+static bool armclk_unsafe(void)
+{
+	uint32_t throttled = tag_get_throttled()&THROTTLED_NOW;
+	uint32_t temp = tag_temp_get();
+	uint32_t temp_max = tag_temp_get_max();
+
+	if (throttled || temp+ARMCLK_TEMP_MARGIN >= temp_max) {
+		serial_log("ARM clock: temperature %u/%u mC, throttled flags %x", 
+			   temp, temp_max, throttled);
+		return true;
+	}
+	return false;
+}
+
+void armclk_boost(void)
+{
+	uint32_t max_rate = tag_clock_get_max_rate(CLK_ARM);
+	uint32_t rate;
+
+	armclk.orig_rate = tag_clock_get_rate(CLK_ARM);
+	if (armclk.orig_rate >= max_rate) {
+		serial_log("ARM clock already at max rate %u Hz", armclk.orig_rate);
+		return;
+	}
+	if (armclk_unsafe()) {
+		serial_log("Not boosting ARM clock, staying at %u Hz", armclk.orig_rate);
+		return;
+	}
+	rate = tag_clock_set_rate(CLK_ARM, max_rate);
+	armclk.boosted = true;
+	serial_log("Boosted ARM clock from %u Hz to %u Hz", armclk.orig_rate, rate);
+}
+
+void armclk_check(void)
+{
+	if (armclk.boosted && armclk_unsafe()) {
+		serial_log("Dropping ARM clock boost");
+		armclk_restore();
+	}
+}
+
+void armclk_restore(void)
+{
+	if (!armclk.boosted)
+		return;
+	tag_clock_set_rate(CLK_ARM, armclk.orig_rate);
+	armclk.boosted = false;
+	serial_log("Restored ARM clock to %u Hz", armclk.orig_rate);
+}
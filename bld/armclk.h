@@ -0,0 +1,36 @@
+/*
+ * Copyright (C) 2023 Petar Turukalo
+ * SPDX-License-Identifier: GPL-2.0
+ *
+ * Run the ARM cores at their max clock rate while the image is loaded, 
+ * instead of the low default rate the firmware leaves them at, so the CPU 
+ * bound work of the load (draining the data FIFO, copying out of the block 
+ * cache, validating) finishes sooner.
+ */
+#ifndef ARMCLK_H
+#define ARMCLK_H
+
+/*
+ * Whether to set the ARM clock back to the rate the firmware left it at 
+ * before handing off to the kernel, so the kernel's cpufreq driver starts 
+ * from the firmware's policy.
+ */
+#ifndef ARMCLK_RESTORE
+#define ARMCLK_RESTORE 1
+#endif
+
+/**
+ * @brief Raise the ARM clock to its max rate, unless the SoC is already close 
+ *	  to its temperature limit or being throttled.
+ */
+void armclk_boost(void);
+/**
+ * @brief Drop the ARM clock back to the rate it was at before armclk_boost() if 
+ *	  the SoC has since got close to its temperature limit or been throttled.
+ *	  Meant to be called between stages of the load.
+ */
+void armclk_check(void);
+/** @brief Set the ARM clock back to the rate it was at before armclk_boost(). */
+void armclk_restore(void);
+
+#endif
@@ -7,6 +7,7 @@
 #include "mbr.h"
 #include "img.h"
 #include "sd/sd.h"
+#include "sd/cache.h"
 #include "debug.h"
 #include "heap.h"
 #include "help.h"
@@ -14,6 +15,13 @@
 #include "addrmap.h"
 #include "int.h"
 #include "gic.h"
+#include "sched.h"
+#include "mmu.h"
+#include "worker.h"
+#include "timer.h"
+#include "armclk.h"
+#include "tag.h"
+#include "lz4.h"
 
 #ifndef IMAGE_PARTITION
 #error IMAGE_PARTITION not defined. Set image_partition variable in Makefile.
@@ -23,6 +31,11 @@
 /* Kernel zImage magic number and offset to it from start of the zImage. */
 #define ZIMAGE_MAGIC 0x016F2818
 #define ZIMAGE_MAGIC_OFF 0x24
+/* 
+ * Blocks of a compressed item read at a time, so that the chunks already read are
+ * decompressed while the next blocks are read.
+ */
+#define LZ4_READ_NBLKS 512  /* 256 KiB. */
 
 /* Assembly labels. */
 extern void vector_table(void);
@@ -34,39 +47,25 @@ static void install_vector_table(void)
 	mcopy(vector_table, (byte_t *)0x0, vector_table_pool_end-vector_table);
 }
 
-/** @brief Enable interrupts and initialise peripherals. */
-static void init_peripherals(void)
-{
-	enum sd_init_error error;
-
-	uart_init();
-	serial_log("Bootloader started: enabled mini UART");
-#if !ENABLE_GIC
-	enable_interrupts();
-	ic_enable_interrupts();
-	serial_log("Enabled interrupts");
-#endif
-
-	error = sd_init();
-	if (error != SD_INIT_ERROR_NONE) {
-		serial_log("Failed to initialise SD");
-		signal_error(ERROR_SD_INIT);
-	}
-}
-
-/** @brief Disable interrupts and reset the peripherals initialised in init_peripherals(). */
+/** @brief Disable interrupts and reset the peripherals initialised by the init steps. */
 static void reset_peripherals(void)
 {
+	workers_park();
+#if ARMCLK_RESTORE
+	armclk_restore();
+#endif
 	if (!sd_reset()) {
 		serial_log("Error: failed to reset SD");
 		signal_error(ERROR_SD_RESET);
 	}
-	/* Note the mini UART isn't reset so the kernel can use it as a serial console. */
-#if !ENABLE_GIC
+	/* Note the UART isn't reset so the kernel can use it as a serial console. */
+#if ENABLE_GIC
+	gic_disable_interrupts();
+#else
 	ic_disable_interrupts();
+#endif
 	disable_interrupts();
 	serial_log("Disabled interrupts");
-#endif
 }
 
 /**
@@ -75,11 +74,11 @@ static void reset_peripherals(void)
  */
 static byte_t *load_mbr(void)
 {
-	byte_t *mbr_base_addr = heap_get_base_address();
+	byte_t *mbr_base_addr = heap_alloc(SD_BLKSZ, HEAP_ALIGN_DMA);
 
 	serial_log("Loading MBR...");
 
-	if (!sd_read_blocks(mbr_base_addr, 0, 1))
+	if (!sd_cache_read_blocks(mbr_base_addr, 0, 1))
 		signal_error(ERROR_SD_READ);
 	if (!mbr_magic(mbr_base_addr)) {
 		serial_log("Error: couldn't find MBR on SD card: no MBR magic");
@@ -95,22 +94,28 @@ static byte_t *load_mbr(void)
 }
 
 /**
- * @brief Load the start of the image from the image partition into RAM.
- * @return The logical block address (LBA) of the image partition on success.
+ * @brief Load the start of the image from the image partition into RAM. This is 
+ *	  the head of a version 1, 2 or 3 image, which all share where their magic 
+ *	  and image size are, and so are told apart by the magic.
+ * @return The image head on success.
+ *
+ * @param[out] img_part_lba_out The logical block address (LBA) of the image partition
  */
-static uint32_t load_image_head(byte_t *mbr_base_addr)
+static struct image *load_image_head(byte_t *mbr_base_addr, uint32_t *img_part_lba_out)
 {
 	uint32_t img_part_lba = mbr_get_partition_lba(mbr_base_addr, IMAGE_PARTITION);
 	uint32_t img_part_nblks = mbr_get_partition_nblks(mbr_base_addr, IMAGE_PARTITION);
-	/* Got all the data needed from MBR so safe to overwrite it in heap. */
-	struct image *img = heap_get_base_address();
+	struct image *img = heap_alloc(SD_BLKSZ, HEAP_ALIGN_DMA);
 
 	serial_log("Loading image head from partition %u", IMAGE_PARTITION);
 
-	/* Read first block of image from image partition into RAM. */
-	if (!sd_read_blocks((byte_t *)img, img_part_lba, 1))
+	/* 
+	 * Read first block of image from image partition into RAM. This also caches
+	 * the blocks after it, which has the first block of the first item.
+	 */
+	if (!sd_cache_read_blocks((byte_t *)img, img_part_lba, 1))
 		signal_error(ERROR_SD_READ);
-	if (img->magic != IMG_MAGIC) {
+	if (img->magic != IMG_MAGIC && img->magic != IMG_MAGIC_V2 && img->magic != IMG_MAGIC_V3) {
 		serial_log("Error: couldn't find image at start of partition %u: "
 			   "no image magic", IMAGE_PARTITION);
 		signal_error(ERROR_NO_IMAGE_MAGIC);
@@ -120,11 +125,134 @@ static uint32_t load_image_head(byte_t *mbr_base_addr)
 			   "of image partition %u bytes", img->imgsz, img_part_nblks*SD_BLKSZ);
 		signal_error(ERROR_IMAGE_OVERFLOW);
 	}
-	serial_log("Successfully loaded and validated image head, "
-		   "image size %u bytes", img->imgsz);
-	return img_part_lba;
+	serial_log("Successfully loaded and validated version %u image head, "
+		   "image size %u bytes", 
+		   img->magic == IMG_MAGIC_V3 ? 3 : img->magic == IMG_MAGIC_V2 ? 2 : 1, 
+		   img->imgsz);
+	*img_part_lba_out = img_part_lba;
+	return img;
 }
 
+/** @brief Start address of the MBR in RAM, once the MBR init step is done. */
+static byte_t *mbr_base_addr;
+
+static enum step_status init_uart_step(void)
+{
+	/* The VideoCore looks up the core clock rate the UART needs while its pins are set up. */
+	tag_boot_state_post();
+	uart_init();
+#if UART_PL011
+	serial_log("Bootloader started: enabled PL011 UART");
+#else
+	serial_log("Bootloader started: enabled mini UART");
+#endif
+	return STEP_STATUS_DONE;
+}
+
+static enum step_status init_interrupts_step(void)
+{
+#if ENABLE_GIC
+	gic_enable_interrupts();
+#else
+	ic_enable_interrupts();
+#endif
+	enable_interrupts();
+	serial_log("Enabled interrupts");
+	return STEP_STATUS_DONE;
+}
+
+static enum step_status start_workers_step(void)
+{
+	workers_start();
+	return STEP_STATUS_DONE;
+}
+
+static enum step_status assert_vc_init_step(void)
+{
+	sd_assert_vc_init();
+	return STEP_STATUS_DONE;
+}
+
+/** 
+ * @brief Initialise SD, pending while the card powers up rather than waiting on it. 
+ */
+static enum step_status init_sd_step(void)
+{
+	static bool started;
+	enum sd_init_error error;
+	bool done = false;
+
+	if (!started) {
+		error = sd_init_start();
+		started = true;
+	} else {
+		error = sd_init_poll(&done);
+	}
+	if (error != SD_INIT_ERROR_NONE) {
+		serial_log("Failed to initialise SD");
+		signal_error(ERROR_SD_INIT);
+	}
+	return done ? STEP_STATUS_DONE : STEP_STATUS_PENDING;
+}
+
+static enum step_status boost_armclk_step(void)
+{
+	armclk_boost();
+	return STEP_STATUS_DONE;
+}
+
+static enum step_status load_mbr_step(void)
+{
+	mbr_base_addr = load_mbr();
+	return STEP_STATUS_DONE;
+}
+
+/** @brief Indices of the init steps in init_steps. */
+enum init_step_id {
+	INIT_STEP_UART,
+	INIT_STEP_INTERRUPTS,
+	INIT_STEP_ASSERT_VC_INIT,
+	INIT_STEP_SD,
+	INIT_STEP_WORKERS,
+	INIT_STEP_ARMCLK,
+	INIT_STEP_MBR
+};
+
+/**
+ * The steps to get from entering C to having the MBR loaded. Each step depends on
+ * the UART so that it can log, and on nothing else it doesn't directly need, so that
+ * it's free to run while another step is waiting on hardware. Steps run in array 
+ * order, so the SD step comes straight after its dependencies, to start the card 
+ * powering up before the steps that don't need the card run while it does.
+ */
+static struct step init_steps[] = {
+	[INIT_STEP_UART] = { 
+		"UART", init_uart_step, 0 
+	},
+	[INIT_STEP_INTERRUPTS] = { 
+		"interrupts", init_interrupts_step, STEP_DEP(INIT_STEP_UART) 
+	},
+	/* Checks the VideoCore state the UART step already requested through the mailbox. */
+	[INIT_STEP_ASSERT_VC_INIT] = { 
+		"VideoCore MMC asserts", assert_vc_init_step, STEP_DEP(INIT_STEP_UART) 
+	},
+	/* The SD driver sleeps, which needs interrupts. */
+	[INIT_STEP_SD] = { 
+		"SD", init_sd_step, 
+		STEP_DEP(INIT_STEP_INTERRUPTS)|STEP_DEP(INIT_STEP_ASSERT_VC_INIT) 
+	},
+	[INIT_STEP_WORKERS] = { 
+		"workers", start_workers_step, STEP_DEP(INIT_STEP_UART) 
+	},
+	/* Several mailbox round trips, which overlap the card's power up. */
+	[INIT_STEP_ARMCLK] = { 
+		"ARM clock boost", boost_armclk_step, STEP_DEP(INIT_STEP_UART) 
+	},
+	[INIT_STEP_MBR] = { 
+		"MBR", load_mbr_step, STEP_DEP(INIT_STEP_SD) 
+	}
+};
+
 /**
  * @brief Get the string name of an item which an item ID identifies.
  */
@@ -146,17 +274,26 @@ static int itemsz(struct item *item)
 }
 
 /**
- * @brief Load an image item from the SD card into RAM.
+ * @brief Start loading an image item from the SD card into RAM. Only the first block
+ *	  of the item, which has the item header, is loaded by the time this returns: the 
+ *	  rest is left in flight, to be waited on with load_item_wait().
+ *
+ * @param limit_addr RAM address the item's data must end at or before, checked before 
+ *		     the rest of the item is read so that an oversized item isn't read
+ *		     over what's after it
+ * @param overflow_error Error to signal if the item's data would go past limit_addr
  */
-static struct item *load_item(enum item_id id, byte_t *ram_item_dest_addr, 
-			      uint32_t sd_item_src_lba)
+static struct item *load_item_submit(enum item_id id, byte_t *ram_item_dest_addr, 
+				     uint32_t sd_item_src_lba, uint32_t limit_addr, 
+				     enum error_code overflow_error)
 {
+	uint32_t data_addr = (uint32_t)ram_item_dest_addr+sizeof(struct item);
 	struct item *item;
 
 	serial_log("Loading %s item to RAM address %08x...", stritem(id), ram_item_dest_addr);
 
 	/* Read first block of item to get its size. */
-	if (!sd_read_blocks(ram_item_dest_addr, sd_item_src_lba, 1))
+	if (!sd_cache_read_blocks(ram_item_dest_addr, sd_item_src_lba, 1))
 		signal_error(ERROR_SD_READ);
 	item = (struct item *)ram_item_dest_addr;
 	if (item->id != id) {
@@ -164,17 +301,42 @@ static struct item *load_item(enum item_id id, byte_t *ram_item_dest_addr,
 			   stritem(item->id), stritem(id));
 		signal_error(ERROR_IMAGE_CONTENTS);
 	}
-	/* Read rest of item. */
+	/* The end item is only given its first block to load into. */
+	if (id == ITEM_ID_END && item->datasz) {
+		serial_log("Error: end item has data size %u bytes, expected 0", item->datasz);
+		signal_error(ERROR_IMAGE_CONTENTS);
+	}
+	/* Compared this way round so that a huge size can't wrap the end address. */
+	if (item->datasz > limit_addr-data_addr) {
+		serial_log("Error: %s size %u bytes overflows past RAM address %08x",
+			   stritem(id), item->datasz, limit_addr);
+		signal_error(overflow_error);
+	}
+	/* 
+	 * Start reading rest of item, after the first block which has already been read.
+	 * Any of it that was read into the cache along with the first block is copied
+	 * from there, and only the rest is read from the SD card.
+	 */
 	if (itemsz(item) > SD_BLKSZ) {
-		if (!sd_read_bytes(ram_item_dest_addr, sd_item_src_lba, itemsz(item)))
+		if (!sd_cache_read_submit(ram_item_dest_addr+SD_BLKSZ, sd_item_src_lba+1, 
+				    bytes_to_blocks(itemsz(item))-1))
 			signal_error(ERROR_SD_READ);
 	}
-	serial_log("Successfully loaded %s item, data size %u bytes", stritem(id), item->datasz);
 	return item;
 }
 
+/** @brief Wait for the rest of an item started with load_item_submit() to load. */
+static void load_item_wait(struct item *item)
+{
+	if (!sd_read_wait())
+		signal_error(ERROR_SD_READ);
+	armclk_check();
+	serial_log("Successfully loaded %s item, data size %u bytes", stritem(item->id), 
+		   item->datasz);
+}
+
 /**
- * @brief Load the kernel and device tree blob from the SD image into RAM. 
+ * @brief Load the kernel and device tree blob from a version 1 SD image into RAM. 
  */
 static void load_image_items(uint32_t img_part_lba)
 {
@@ -183,37 +345,306 @@ static void load_image_items(uint32_t img_part_lba)
 	 * address so that the start of the item's data is loaded to the RAM address.
 	 */
 	uint32_t item_lba = img_part_lba+1;
-	struct item *item = load_item(ITEM_ID_KERNEL, (byte_t *)(KERN_RAM_ADDR-sizeof(struct item)), 
-				      item_lba);
-	if (KERN_RAM_ADDR+item->datasz > DTB_RAM_ADDR) {
-		serial_log("Error: kernel size %u bytes overflows into device tree blob",
-			   item->datasz);
-		signal_error(ERROR_KERN_OVERFLOW);
-	}
+	struct item *item;
+	heap_mark_t mark;
+	
+	/* 
+	 * Each item's size is validated before the rest of it is read. The magics 
+	 * validated below are all in the first block of their item, so they're 
+	 * validated while the rest of the item is still being read.
+	 */
+	item = load_item_submit(ITEM_ID_KERNEL, (byte_t *)(KERN_RAM_ADDR-sizeof(struct item)), 
+				item_lba, DTB_RAM_ADDR, ERROR_KERN_OVERFLOW);
 	if (*(uint32_t *)(KERN_RAM_ADDR+ZIMAGE_MAGIC_OFF) != ZIMAGE_MAGIC) {
 		serial_log("Error: couldn't find kernel zImage magic");
 		signal_error(ERROR_IMAGE_CONTENTS);
 	}
+	load_item_wait(item);
 	serial_log("Successfully validated kernel");
 
 	item_lba += bytes_to_blocks(itemsz(item));
-	item = load_item(ITEM_ID_DEVICE_TREE_BLOB, (byte_t *)(DTB_RAM_ADDR-sizeof(struct item)), 
-			 item_lba);
+	item = load_item_submit(ITEM_ID_DEVICE_TREE_BLOB, 
+				(byte_t *)(DTB_RAM_ADDR-sizeof(struct item)), item_lba,
+				HEAP_RAM_ADDR, ERROR_DTB_OVERFLOW);
 	if (bswap32(*(uint32_t *)DTB_RAM_ADDR) != DTB_MAGIC) {
 		serial_log("Error: couldn't find device tree blob magic");
 		signal_error(ERROR_IMAGE_CONTENTS);
 	}
+	load_item_wait(item);
 	serial_log("Successfully validated device tree blob");
 
-	/* Validate that the terminating item is there. */
+	/* Validate that the terminating item is there. It's only needed for that. */
+	mark = heap_mark();
 	item_lba += bytes_to_blocks(itemsz(item));
-	item = load_item(ITEM_ID_END, heap_get_base_address(), item_lba);
+	item = load_item_submit(ITEM_ID_END, heap_alloc(SD_BLKSZ, HEAP_ALIGN_DMA), item_lba,
+				HEAP_END_RAM_ADDR, ERROR_IMAGE_CONTENTS);
+	load_item_wait(item);
+	heap_free_to_mark(mark);
+}
+
+/**
+ * @brief Get the version 3 image head equivalent to a version 2 image head, so that
+ *	  both versions are loaded the same way. A version 2 item is never compressed,
+ *	  so its raw size is its data size.
+ */
+static struct image_v3 *image_v2_to_v3(struct image_v2 *v2)
+{
+	struct image_v3 *v3 = heap_alloc(sizeof(struct image_v3), HEAP_ALIGN_DMA);
+
+	/* The version 2 table of contents has room for more entries than version 3. */
+	if (v2->nentries > IMG_TOC_NENTRIES) {
+		serial_log("Error: image has %u table of contents entries, at most %u supported", 
+			   v2->nentries, IMG_TOC_NENTRIES);
+		signal_error(ERROR_IMAGE_CONTENTS);
+	}
+	v3->magic = IMG_MAGIC_V3;
+	v3->imgsz = v2->imgsz;
+	v3->nentries = v2->nentries;
+	for (int i = 0; i < v2->nentries; ++i) {
+		if (v2->toc[i].flags) {
+			serial_log("Error: version 2 image item has flags %x, expected none", 
+				   v2->toc[i].flags);
+			signal_error(ERROR_IMAGE_CONTENTS);
+		}
+		v3->toc[i].id = v2->toc[i].id;
+		v3->toc[i].lba = v2->toc[i].lba;
+		v3->toc[i].datasz = v2->toc[i].datasz;
+		v3->toc[i].load_addr = v2->toc[i].load_addr;
+		v3->toc[i].flags = 0;
+		v3->toc[i].rawsz = v2->toc[i].datasz;
+	}
+	return v3;
+}
+
+/**
+ * @brief Get the table of contents entry of an item in a version 3 image, validated
+ *	  against the image and the address it's expected to be loaded to.
+ */
+static struct toc_entry *toc_item_get(struct image_v3 *img, enum item_id id, 
+				      uint32_t load_addr)
+{
+	struct toc_entry *entry = NULL;
+
+	if (img->nentries > IMG_TOC_NENTRIES) {
+		serial_log("Error: image has %u table of contents entries, at most %u fit", 
+			   img->nentries, IMG_TOC_NENTRIES);
+		signal_error(ERROR_IMAGE_CONTENTS);
+	}
+	for (int i = 0; i < img->nentries; ++i) {
+		if (img->toc[i].id == id) {
+			entry = &img->toc[i];
+			break;
+		}
+	}
+	if (!entry) {
+		serial_log("Error: image has no %s item", stritem(id));
+		signal_error(ERROR_IMAGE_CONTENTS);
+	}
+	if (entry->load_addr != load_addr) {
+		serial_log("Error: %s item load address %08x, expected %08x", 
+			   stritem(id), entry->load_addr, load_addr);
+		signal_error(ERROR_IMAGE_CONTENTS);
+	}
+	if (entry->flags&~ITEM_FLAG_LZ4) {
+		serial_log("Error: %s item has unsupported flags %x", stritem(id), entry->flags);
+		signal_error(ERROR_IMAGE_CONTENTS);
+	}
+	if (!entry->datasz || !entry->rawsz) {
+		serial_log("Error: %s item is empty", stritem(id));
+		signal_error(ERROR_IMAGE_CONTENTS);
+	}
+	if (!entry->lba || entry->lba+bytes_to_blocks(entry->datasz) > 
+			   bytes_to_blocks(img->imgsz)) {
+		serial_log("Error: %s item isn't within the image", stritem(id));
+		signal_error(ERROR_IMAGE_CONTENTS);
+	}
+	return entry;
+}
+
+/** 
+ * @brief Get the number of bytes loading an item writes to RAM: its raw size if it's
+ *	  decompressed there, otherwise its data rounded up to whole blocks.
+ */
+static uint32_t toc_item_loadsz(struct toc_entry *entry)
+{
+	if (entry->flags&ITEM_FLAG_LZ4)
+		return entry->rawsz;
+	return bytes_to_blocks(entry->datasz)*SD_BLKSZ;
+}
+
+/** @brief Get the number of chunks a compressed item is split into. */
+static int lz4_nchunks(struct toc_entry *entry)
+{
+	return entry->rawsz/LZ4_CHUNKSZ + (entry->rawsz%LZ4_CHUNKSZ ? 1 : 0);
+}
+
+/** @brief Decompression of a chunk of a compressed item, run as a worker job. */
+struct lz4_chunk_job {
+	struct lz4_chunk *chunk;
+	byte_t *dest;
+	int rawsz;
+	bool ok;  /**< Whether the chunk decompressed to exactly rawsz bytes. */
+};
+
+static void lz4_chunk_job_fn(void *arg)
+{
+	struct lz4_chunk_job *job = arg;
+	int size = job->chunk->size&~LZ4_CHUNK_UNCOMPRESSED;
+
+	if (job->chunk->size&LZ4_CHUNK_UNCOMPRESSED) {
+		job->ok = size == job->rawsz;
+		if (job->ok)
+			mcopy(job->chunk->data, job->dest, size);
+	} else
+		job->ok = lz4_decompress(job->chunk->data, size, job->dest, job->rawsz) == job->rawsz;
+}
+
+/**
+ * @brief Queue the decompression of the chunks of a compressed item that have been 
+ *	  read in full, from the chunk at an offset into the compressed data onwards.
+ * @return Offset of the first chunk not queued.
+ *
+ * @param comp Start of the compressed data
+ * @param readsz Number of bytes of the compressed data read so far
+ * @param jobs A job for each chunk, of which the first nqueued are already queued
+ */
+static uint32_t lz4_queue_chunks(struct toc_entry *entry, byte_t *comp, uint32_t off, 
+				 uint32_t readsz, struct lz4_chunk_job *jobs, int *nqueued)
+{
+	int njobs = lz4_nchunks(entry);
+	struct lz4_chunk *chunk;
+	struct lz4_chunk_job *job;
+	uint32_t size;
+
+	while (*nqueued < njobs && off+sizeof(struct lz4_chunk) <= readsz) {
+		chunk = (struct lz4_chunk *)(comp+off);
+		size = chunk->size&~LZ4_CHUNK_UNCOMPRESSED;
+		if (off+sizeof(struct lz4_chunk)+size > readsz)
+			break;
+		job = &jobs[*nqueued];
+		job->chunk = chunk;
+		job->dest = (byte_t *)entry->load_addr+*nqueued*LZ4_CHUNKSZ;
+		job->rawsz = min(LZ4_CHUNKSZ, entry->rawsz-*nqueued*LZ4_CHUNKSZ);
+		job->ok = false;
+		worker_submit(lz4_chunk_job_fn, job);
+		++*nqueued;
+		/* Chunks are padded to keep the next chunk's size aligned. */
+		off += sizeof(struct lz4_chunk)+((size+3)&~3);
+	}
+	return off;
+}
+
+/**
+ * @brief Load a compressed item of a version 3 image, decompressing it to its load
+ *	  address. The compressed data is read into the heap a few blocks at a time,
+ *	  and the chunks each read completes are handed to the workers to decompress
+ *	  while the next blocks are read, so that decompressing overlaps reading 
+ *	  rather than following it.
+ */
+static void toc_item_load_lz4(struct toc_entry *entry, uint32_t img_part_lba)
+{
+	int nblks = bytes_to_blocks(entry->datasz);
+	int njobs = lz4_nchunks(entry);
+	heap_mark_t mark = heap_mark();
+	byte_t *comp = heap_alloc(nblks*SD_BLKSZ, HEAP_ALIGN_DMA);
+	struct lz4_chunk_job *jobs = heap_alloc(njobs*sizeof(struct lz4_chunk_job), 4);
+	int nread = 0, nqueued = 0;
+	int read_nblks;
+	uint32_t off = 0;
+
+	while (nread < nblks) {
+		read_nblks = min(nblks-nread, LZ4_READ_NBLKS);
+		if (!sd_cache_read_submit(comp+nread*SD_BLKSZ, img_part_lba+entry->lba+nread, 
+					  read_nblks))
+			signal_error(ERROR_SD_READ);
+		off = lz4_queue_chunks(entry, comp, off, min(nread*SD_BLKSZ, entry->datasz), 
+				       jobs, &nqueued);
+		if (!sd_read_wait())
+			signal_error(ERROR_SD_READ);
+		nread += read_nblks;
+	}
+	lz4_queue_chunks(entry, comp, off, entry->datasz, jobs, &nqueued);
+	workers_wait();
+
+	if (nqueued != njobs) {
+		serial_log("Error: %s item has %u compressed chunks, expected %u", 
+			   stritem(entry->id), nqueued, njobs);
+		signal_error(ERROR_IMAGE_CONTENTS);
+	}
+	for (int i = 0; i < njobs; ++i) {
+		if (!jobs[i].ok) {
+			serial_log("Error: failed to decompress chunk %u of %s item", 
+				   i, stritem(entry->id));
+			signal_error(ERROR_IMAGE_CONTENTS);
+		}
+	}
+	heap_free_to_mark(mark);
+}
+
+/** @brief Load an item of a version 3 image to its load address. */
+static void toc_item_load(struct toc_entry *entry, uint32_t img_part_lba)
+{
+	serial_log("Loading %s item to RAM address %08x...", stritem(entry->id), 
+		   entry->load_addr);
+	if (entry->flags&ITEM_FLAG_LZ4) {
+		toc_item_load_lz4(entry, img_part_lba);
+	} else {
+		/* An uncompressed item is read in a single read. */
+		if (!sd_cache_read_submit((byte_t *)entry->load_addr, img_part_lba+entry->lba, 
+					  bytes_to_blocks(entry->datasz)))
+			signal_error(ERROR_SD_READ);
+		if (!sd_read_wait())
+			signal_error(ERROR_SD_READ);
+	}
+	armclk_check();
+	serial_log("Successfully loaded %s item, data size %u bytes, raw size %u bytes", 
+		   stritem(entry->id), entry->datasz, entry->rawsz);
+}
+
+/**
+ * @brief Load the kernel and device tree blob from a version 3 SD image into RAM.
+ *	  Where every item is and how big it is is known from the table of contents 
+ *	  before any of them are read, so each is validated to fit up front and then
+ *	  read in one go, instead of first reading its first block to find its size.
+ */
+static void load_image_toc(struct image_v3 *img, uint32_t img_part_lba)
+{
+	struct toc_entry *kern, *dtb;
+
+	kern = toc_item_get(img, ITEM_ID_KERNEL, KERN_RAM_ADDR);
+	if (KERN_RAM_ADDR+toc_item_loadsz(kern) > DTB_RAM_ADDR) {
+		serial_log("Error: kernel size %u bytes overflows into device tree blob",
+			   kern->datasz);
+		signal_error(ERROR_KERN_OVERFLOW);
+	}
+	dtb = toc_item_get(img, ITEM_ID_DEVICE_TREE_BLOB, DTB_RAM_ADDR);
+	if (DTB_RAM_ADDR+toc_item_loadsz(dtb) > HEAP_RAM_ADDR) {
+		serial_log("Error: device tree blob size %u bytes overflows into heap",
+			   dtb->datasz);
+		signal_error(ERROR_DTB_OVERFLOW);
+	}
+
+	toc_item_load(kern, img_part_lba);
+	if (*(uint32_t *)(KERN_RAM_ADDR+ZIMAGE_MAGIC_OFF) != ZIMAGE_MAGIC) {
+		serial_log("Error: couldn't find kernel zImage magic");
+		signal_error(ERROR_IMAGE_CONTENTS);
+	}
+	serial_log("Successfully validated kernel");
+
+	toc_item_load(dtb, img_part_lba);
+	if (bswap32(*(uint32_t *)DTB_RAM_ADDR) != DTB_MAGIC) {
+		serial_log("Error: couldn't find device tree blob magic");
+		signal_error(ERROR_IMAGE_CONTENTS);
+	}
+	serial_log("Successfully validated device tree blob");
 }
 
 static void boot_kernel(void)
 {
 	serial_log("Jumping to kernel...");
-	
+	/* The kernel takes over the UART, possibly as its serial console. */
+	log_flush();
+
 	__asm__("mov r3, #" MSTRFY(KERN_RAM_ADDR) "\n\t"
 		"hvc #0");  /* Go to hypervisor mode which will execute _boot_kernel. */
 }
@@ -224,14 +655,24 @@ static void boot_kernel(void)
  */
 void c_entry(void)
 {
-	byte_t *mbr_base_addr;
+	struct image *img;
 	uint32_t img_part_lba;
 
+	/* 
+	 * Install before the MMU is on so the vector table is already in RAM for 
+	 * the hypervisor, which doesn't go through the caches, to fetch from. 
+	 */
 	install_vector_table();
-	init_peripherals();
-	mbr_base_addr = load_mbr();
-	img_part_lba = load_image_head(mbr_base_addr);
-	load_image_items(img_part_lba);
+	mmu_enable();
+	timer_init();
+	sched_run(init_steps, array_len(init_steps));
+	img = load_image_head(mbr_base_addr, &img_part_lba);
+	if (img->magic == IMG_MAGIC_V3)
+		load_image_toc((struct image_v3 *)img, img_part_lba);
+	else if (img->magic == IMG_MAGIC_V2)
+		load_image_toc(image_v2_to_v3((struct image_v2 *)img), img_part_lba);
+	else
+		load_image_items(img_part_lba);
 	reset_peripherals();
 	boot_kernel();
 }
@@ -7,6 +7,7 @@
 #include "timer.h"
 #include "help.h"
 #include "error.h"
+#include "binlog.h"
 #include <stdarg.h>
 
 int Strlen(char *s)
@@ -18,6 +19,9 @@ int Strlen(char *s)
 	return n;
 }
 
+/* The text formatting isn't needed when the host formats binary records. */
+#if !LOG_BINARY
+
 /**
  * Like the regular strncpy() except returns the number of bytes 
  * copied instead.
@@ -228,12 +232,112 @@ static void Snprintf(char *s, int n, char *fmt, ...)
 	va_end(ap);
 }
 
+#endif
+
+/* Size of the log ring buffer in bytes. Must be a power of 2. */
+#define LOG_RING_SZ 0x2000
+
+/**
+ * Log output queued to be transmitted. The head and tail only ever increase,
+ * and are taken modulo the size to index the buffer, so head-tail is the number
+ * of queued bytes.
+ */
+static struct {
+	char buf[LOG_RING_SZ];
+	uint32_t head;  /**< Where to queue the next byte */
+	uint32_t tail;  /**< Next byte to transmit */
+} ring;
+
+/** @return The number of queued bytes contiguous in the buffer from the tail. */
+static int ring_contiguous_queued(void)
+{
+	int tail_off = ring.tail%LOG_RING_SZ;
+
+	return min(ring.head-ring.tail, LOG_RING_SZ-tail_off);
+}
+
+void log_drain(void)
+{
+	int n;
+
+	while ((n = ring_contiguous_queued())) {
+		n = uart_transmit_nonblock(&ring.buf[ring.tail%LOG_RING_SZ], n);
+		if (!n)
+			break;
+		ring.tail += n;
+	}
+}
+
+/** @brief Wait until the ring has room for n more bytes. */
+static void ring_make_room(int n)
+{
+	int drain;
+
+	while (LOG_RING_SZ-(ring.head-ring.tail) < n) {
+		drain = min(ring_contiguous_queued(), n);
+		uart_transmit(&ring.buf[ring.tail%LOG_RING_SZ], drain);
+		ring.tail += drain;
+	}
+}
+
+void log_flush(void)
+{
+	ring_make_room(LOG_RING_SZ);
+}
+
+static void ring_queue(char *s, int n)
+{
+	ring_make_room(n);
+	for (int i = 0; i < n; ++i)
+		ring.buf[ring.head++%LOG_RING_SZ] = s[i];
+}
+
+#if LOG_BINARY
+/**
+ * @brief Queue a binary record of a message, see binlog.h. Only the format string is
+ *	  scanned, for which arguments to send and how: nothing is formatted.
+ */
+static void binlog(char *fmt, va_list ap)
+{
+	struct binlog_record rec = { BINLOG_SYNC, (uint32_t)fmt, timer_current_us() };
+	uint32_t arg;
+	char *sarg;
+
+	ring_queue((char *)&rec, sizeof(rec));
+	for (; *fmt; ++fmt) {
+		if (*fmt != '%')
+			continue;
+		/* Skip the field width, which the decoder applies. */
+		while (*++fmt >= '0' && *fmt <= '9')
+			;
+		switch (*fmt) {
+			case 'u':
+			case 'x':
+				arg = va_arg(ap, uint32_t);
+				ring_queue((char *)&arg, sizeof(arg));
+				break;
+			case 's':
+				sarg = va_arg(ap, char *);
+				ring_queue(sarg, Strlen(sarg)+1);
+				break;
+			default:
+				signal_error(ERROR_VSNPRINTF);
+		}
+	}
+}
+#endif
+
 void serial_log(char *fmt, ...)
 {
+	va_list ap;
+#if LOG_BINARY
+	va_start(ap, fmt);
+	binlog(fmt, ap);
+	va_end(ap);
+#else
 	static char newfmt[512];
 	static char buf[1024];
-	va_list ap;
-	timestamp_t ts = timer_current();
+	uint32_t ts = timer_current_us();
 
 	/* 
 	 * Prefix the user's arguments with a timestamp padded to the max width
@@ -245,5 +349,7 @@ void serial_log(char *fmt, ...)
 	Vsnprintf(buf, sizeof(buf), newfmt, ap);
 	va_end(ap);
 
-	uart_transmit(buf, Strlen(buf));
+	ring_queue(buf, Strlen(buf));
+#endif
+	log_drain();
 }
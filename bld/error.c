@@ -5,12 +5,23 @@
 #include "error.h"
 #include "led.h"
 #include "timer.h"
+#include "debug.h"
 
 #define SHORT_PAUSE_MS 370
 #define LONG_PAUSE_MS 2250
 
 void signal_error(enum error_code error)
 {
+	static bool flushing;
+
+	/* 
+	 * Get the log of what went wrong out before stopping for good, unless it's the 
+	 * flush itself that timed out waiting on the UART.
+	 */
+	if (!flushing) {
+		flushing = true;
+		log_flush();
+	}
 	led_init();
 	do {
 		/* 
@@ -22,7 +22,12 @@ enum error_code {
 	ERROR_IMAGE_CONTENTS    = 11,  /**< The contents of the image was not as expected */
 	/** The size of the kernel file loaded into RAM is too big and overflowed into the device tree blob's area of RAM */
 	ERROR_KERN_OVERFLOW     = 12,
-	ERROR_SD_RESET          = 13
+	ERROR_SD_RESET          = 13,
+	/** The dependencies between initialisation steps couldn't be satisfied (see @ref sched_run()) */
+	ERROR_STEP_DEPS         = 14,
+	ERROR_HEAP_OVERFLOW     = 15,  /**< Ran out of heap, see @ref heap_alloc() */
+	/** The size of the device tree blob loaded into RAM is too big and overflowed into the heap */
+	ERROR_DTB_OVERFLOW      = 16
 };
 
 /**
@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2023 Petar Turukalo
+ * SPDX-License-Identifier: GPL-2.0
+ *
+ * Implements the parts of the ARM Generic Interrupt Controller Architecture
+ * Specification version 2 that the bootloader needs. The ARM stub (with 
+ * enable_gic=1) already puts every interrupt in group 1 before dropping to 
+ * the non-secure state, so only the non-secure, group 1 view is used here.
+ */
+#include "gic.h"
+#include "mmio.h"
+#include "bits.h"
+
+/* Offsets of the registers with a bit, or a byte, per interrupt ID. */
+#define GICD_ISENABLER_OFF(intid)  (0x100+(intid)/32*4)
+#define GICD_ICENABLER_OFF(intid)  (0x180+(intid)/32*4)
+#define GICD_IPRIORITYR_OFF(intid) (0x400+(intid)/4*4)
+#define GICD_ITARGETSR_OFF(intid)  (0x800+(intid)/4*4)
+/* Bit of an interrupt in its enable register. */
+#define GICD_ENABLER_BIT(intid)	   BIT((intid)%32)
+/* Shift to an interrupt's byte in its priority or target register. */
+#define GICD_BYTE_SHIFT(intid)	   ((intid)%4*8)
+
+enum gic_dist_register {
+	GICD_CTLR,
+	GICD_ISENABLER_TIMER1,
+	GICD_ISENABLER_EMMC2,
+	GICD_ICENABLER_TIMER1,
+	GICD_ICENABLER_EMMC2,
+	GICD_IPRIORITYR_TIMER1,
+	GICD_IPRIORITYR_EMMC2,
+	GICD_ITARGETSR_TIMER1,
+	GICD_ITARGETSR_EMMC2
+};
+
+static struct periph_access gic_dist_access = {
+	.periph_base_off = 0x3841000,
+	.register_offsets = {
+		[GICD_CTLR]		 = 0x000,
+		[GICD_ISENABLER_TIMER1]	 = GICD_ISENABLER_OFF(GIC_INTID_TIMER1),
+		[GICD_ISENABLER_EMMC2]	 = GICD_ISENABLER_OFF(GIC_INTID_EMMC2),
+		[GICD_ICENABLER_TIMER1]	 = GICD_ICENABLER_OFF(GIC_INTID_TIMER1),
+		[GICD_ICENABLER_EMMC2]	 = GICD_ICENABLER_OFF(GIC_INTID_EMMC2),
+		[GICD_IPRIORITYR_TIMER1] = GICD_IPRIORITYR_OFF(GIC_INTID_TIMER1),
+		[GICD_IPRIORITYR_EMMC2]	 = GICD_IPRIORITYR_OFF(GIC_INTID_EMMC2),
+		[GICD_ITARGETSR_TIMER1]	 = GICD_ITARGETSR_OFF(GIC_INTID_TIMER1),
+		[GICD_ITARGETSR_EMMC2]	 = GICD_ITARGETSR_OFF(GIC_INTID_EMMC2)
+	}
+};
+
+/* Enable forwarding group 1 interrupts to the CPU interfaces (non-secure view). */
+#define GICD_CTLR_ENABLE_GRP1  BIT(0)
+
+enum gic_cpu_register {
+	GICC_CTLR,
+	GICC_PMR,
+	GICC_IAR,
+	GICC_EOIR
+};
+
+static struct periph_access gic_cpu_access = {
+	.periph_base_off = 0x3842000,
+	.register_offsets = {
+		[GICC_CTLR] = 0x00,
+		[GICC_PMR]  = 0x04,
+		[GICC_IAR]  = 0x0c,
+		[GICC_EOIR] = 0x10
+	}
+};
+
+/* Enable signalling group 1 interrupts to the core (non-secure view). */
+#define GICC_CTLR_ENABLE_GRP1  BIT(0)
+/* Lowest priority mask, which lets interrupts of any priority through. */
+#define GICC_PMR_ALL	       0xff
+#define GICC_IAR_INTID	       BITS(9, 0)
+
+/* 
+ * Priority given to the interrupts. Only the top bits are implemented, and the 
+ * non-secure view can't use the top half, so anything from 0x80 up works.
+ */
+#define GIC_PRIORITY	    0xa0
+/* Target only CPU interface 0, the primary core's, which is the one taking interrupts. */
+#define GIC_TARGET_CPU0	    BIT(0)
+
+/**
+ * @brief Give an interrupt its priority and route it to the primary core.
+ */
+static void gic_route_irq(int intid, int priority_reg, int target_reg)
+{
+	uint32_t byte_mask = 0xff<<GICD_BYTE_SHIFT(intid);
+
+	register_disable_bits(&gic_dist_access, priority_reg, byte_mask);
+	register_enable_bits(&gic_dist_access, priority_reg, 
+			     GIC_PRIORITY<<GICD_BYTE_SHIFT(intid));
+	register_disable_bits(&gic_dist_access, target_reg, byte_mask);
+	register_enable_bits(&gic_dist_access, target_reg, 
+			     GIC_TARGET_CPU0<<GICD_BYTE_SHIFT(intid));
+}
+
+void gic_enable_interrupts(void)
+{
+	gic_route_irq(GIC_INTID_TIMER1, GICD_IPRIORITYR_TIMER1, GICD_ITARGETSR_TIMER1);
+	gic_route_irq(GIC_INTID_EMMC2, GICD_IPRIORITYR_EMMC2, GICD_ITARGETSR_EMMC2);
+	/* Writing a 0 to a set-enable bit has no effect, so no read-modify-write is needed. */
+	register_set(&gic_dist_access, GICD_ISENABLER_TIMER1, GICD_ENABLER_BIT(GIC_INTID_TIMER1));
+	register_set(&gic_dist_access, GICD_ISENABLER_EMMC2, GICD_ENABLER_BIT(GIC_INTID_EMMC2));
+
+	register_enable_bits(&gic_dist_access, GICD_CTLR, GICD_CTLR_ENABLE_GRP1);
+	register_set(&gic_cpu_access, GICC_PMR, GICC_PMR_ALL);
+	register_enable_bits(&gic_cpu_access, GICC_CTLR, GICC_CTLR_ENABLE_GRP1);
+}
+
+void gic_disable_interrupts(void)
+{
+	/* 
+	 * Only the interrupts are disabled: the distributor and CPU interface are left
+	 * enabled as the ARM stub had them, for the kernel.
+	 */
+	register_set(&gic_dist_access, GICD_ICENABLER_TIMER1, GICD_ENABLER_BIT(GIC_INTID_TIMER1));
+	register_set(&gic_dist_access, GICD_ICENABLER_EMMC2, GICD_ENABLER_BIT(GIC_INTID_EMMC2));
+}
+
+uint32_t gic_acknowledge_irq(void)
+{
+	return register_get(&gic_cpu_access, GICC_IAR);
+}
+
+uint32_t gic_intid(uint32_t ack)
+{
+	return ack&GICC_IAR_INTID;
+}
+
+void gic_end_irq(uint32_t ack)
+{
+	register_set(&gic_cpu_access, GICC_EOIR, ack);
+}
@@ -1,10 +1,15 @@
 /*
  * Copyright (C) 2023 Petar Turukalo
  * SPDX-License-Identifier: GPL-2.0
+ *
+ * The GIC-400 interrupt controller, used from the non-secure state the 
+ * ARM stub leaves the cores in.
  */
 #ifndef GIC_H
 #define GIC_H
 
+#include "type.h"
+
 /**
  * Whether to use the GIC-400 interrupt controller in this
  * bootloader. If set enable_gic=1 must also be set in
@@ -14,16 +19,41 @@
  * Linux using the default BCM2711 device tree. Without this, the 
  * kernel would hang when its SMP code started the secondary cores.
  *
- * With this enabled, however, the legacy interrupt controller 
- * implemented in ic.c and ic.h cannot be used. In this bootloader
- * properly being interrupted (opposed to polling interrupt flags)
- * is really only used by the system timer sleep functionality. 
- * To save me having to learn GIC and implement interrupts with it, 
- * the sleep implementation polls instead of actually sleeping when 
- * this is enabled. Note this bootloader used the legacy interrupt 
+ * With this enabled the legacy interrupt controller implemented in
+ * ic.c and ic.h cannot be used, and the interrupts are taken through
+ * the GIC instead. Note this bootloader used the legacy interrupt 
  * controller until I found (struggled to find, took a long time to 
  * find) that Linux required GIC enabled to boot successfully.
  */
 #define ENABLE_GIC 1
 
+/*
+ * Interrupt IDs. The VideoCore peripheral interrupts are shared peripheral 
+ * interrupts (SPIs) starting at ID 96, in the same order as the legacy 
+ * interrupt controller's VideoCore interrupts.
+ */
+#define GIC_INTID_VC_BASE   96
+#define GIC_INTID_TIMER1    (GIC_INTID_VC_BASE+1)
+#define GIC_INTID_EMMC2     (GIC_INTID_VC_BASE+62)
+/* ID read from an acknowledge when there's no interrupt pending. */
+#define GIC_INTID_SPURIOUS  1023
+
+/**
+ * @brief Enable the distributor and this core's CPU interface, and the interrupts 
+ *	  the bootloader uses, routed to this core.
+ */
+void gic_enable_interrupts(void);
+/** @brief Disable the interrupts enabled in gic_enable_interrupts(). */
+void gic_disable_interrupts(void);
+/**
+ * @brief Acknowledge the highest priority pending interrupt from within the IRQ 
+ *	  exception handler.
+ * @return Value to pass to gic_end_irq() once the interrupt has been serviced. Its
+ *	   interrupt ID is got with gic_intid().
+ */
+uint32_t gic_acknowledge_irq(void);
+uint32_t gic_intid(uint32_t ack);
+/** @brief Signal the end of servicing an interrupt acknowledged with gic_acknowledge_irq(). */
+void gic_end_irq(uint32_t ack);
+
 #endif
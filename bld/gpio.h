@@ -8,6 +8,7 @@
 #define GPIO_H
 
 enum gpio_pin {
+	GPIO_PIN_TXD0 = 14,  /**< Same pin as TXD1, with a different alt function. */
 	GPIO_PIN_TXD1 = 14,
 	GPIO_PIN_LED  = 42
 };
@@ -4,8 +4,36 @@
  */
 #include "heap.h"
 #include "addrmap.h"
+#include "error.h"
+#include "debug.h"
 
-void *heap_get_base_address(void)
+/* The heap must stay clear of the sections below it in the address map. */
+_Static_assert(HEAP_RAM_ADDR > DTB_RAM_ADDR, "heap overlaps the device tree blob");
+_Static_assert(HEAP_RAM_ADDR < HEAP_END_RAM_ADDR, "heap is empty");
+
+/* Address of the next free byte in the heap. */
+static uint32_t heap_top = HEAP_RAM_ADDR;
+
+void *heap_alloc(uint32_t size, uint32_t align)
+{
+	uint32_t addr = (heap_top+align-1)&~(align-1);
+
+	/* Also catch wrapping around the top of the address space. */
+	if (addr < heap_top || addr+size < addr || addr+size > HEAP_END_RAM_ADDR) {
+		serial_log("Error: heap overflow allocating %u bytes: %u bytes free", size, 
+			   HEAP_END_RAM_ADDR-heap_top);
+		signal_error(ERROR_HEAP_OVERFLOW);
+	}
+	heap_top = addr+size;
+	return (void *)addr;
+}
+
+heap_mark_t heap_mark(void)
+{
+	return heap_top;
+}
+
+void heap_free_to_mark(heap_mark_t mark)
 {
-	return (byte_t *)HEAP_RAM_ADDR;
+	heap_top = mark;
 }
@@ -2,19 +2,44 @@
  * Copyright (C) 2023 Petar Turukalo
  * SPDX-License-Identifier: GPL-2.0
  *
- * A large memory area in RAM for this bootloader 
- * program to use for whatever it wants.
+ * A large memory area in RAM for this bootloader program to use for 
+ * whatever it wants, handed out by a bump (arena) allocator: each 
+ * allocation comes straight after the last, and memory is only given
+ * back by rewinding to a mark taken earlier, freeing everything allocated
+ * since. Only the primary core allocates.
  */
 #ifndef HEAP_H
 #define HEAP_H
 
-#include "mmio.h"
+#include "type.h"
+
+/** 
+ * @brief Alignment of a buffer shared with DMA or the VideoCore: a data cache 
+ *	  line, so that no other data shares a line with its ends and is lost when
+ *	  it's invalidated. Its size should be a multiple of this too.
+ */
+#define HEAP_ALIGN_DMA 64
+
+/**
+ * @brief Allocate memory from the heap. Signal error ERROR_HEAP_OVERFLOW if it
+ *	  would go past the end of the heap.
+ *
+ * @param align Power of 2 alignment of the returned address
+ */
+void *heap_alloc(uint32_t size, uint32_t align);
+
+/** @brief A position in the heap to free back to with heap_free_to_mark(). */
+typedef uint32_t heap_mark_t;
 
 /**
- * Get the base address of the heap. There is currently
- * no allocation / memory management implemented - it is 
- * up to the callers (me) to ensure it is used asynchronously.
+ * @brief Get a mark at the current end of the heap's allocations.
+ *
+ * Everything allocated after the mark is freed by heap_free_to_mark(), so memory 
+ * that has to outlive that, e.g. a buffer a driver allocates on first use, must
+ * not be allocated in between.
  */
-void *heap_get_base_address(void);
+heap_mark_t heap_mark(void);
+/** @brief Free everything allocated since a mark was taken with heap_mark(). */
+void heap_free_to_mark(heap_mark_t mark);
 
 #endif
@@ -6,6 +6,13 @@
 #include "timer.h"
 #include "error.h"
 
+/* Bytes moved at a time by the assembly in mem.S. */
+#define MEM_BURST_SZ 64
+
+/* Assembly labels in mem.S. */
+extern void mcopy_bursts(void *src, void *dest, int n);
+extern void mzero_bursts(void *mem, int n);
+
 int min(int n, int m)
 {
 	return (n < m) ? n : m;
@@ -16,20 +23,57 @@ int max(int n, int m)
 	return (n < m) ? m : n;
 }
 
+/** @brief Get whether two addresses are the same distance from a 4-byte aligned address. */
+static bool addresses_mutually_aligned(void *addr1, void *addr2)
+{
+	return !(((uint32_t)addr1^(uint32_t)addr2)&3);
+}
+
 void mzero(void *mem, int n)
 {
 	byte_t *bytes = mem;
-	for (int i = 0; i < n; ++i) 
-		bytes[i] = 0;
+	int nbursts;
+
+	/* Bytes up to the first word boundary. */
+	for (; n > 0 && !address_aligned(bytes, 4); --n)
+		*bytes++ = 0;
+	nbursts = n&~(MEM_BURST_SZ-1);
+	if (nbursts) {
+		mzero_bursts(bytes, nbursts);
+		bytes += nbursts;
+		n -= nbursts;
+	}
+	for (; n >= 4; n -= 4, bytes += 4)
+		*(uint32_t *)bytes = 0;
+	for (; n > 0; --n)
+		*bytes++ = 0;
 }
 
 void mcopy(void *src, void *dest, int n)
 {
 	byte_t *s = src;
 	byte_t *d = dest;
+	int nbursts;
 
-	for (int i = 0; i < n; ++i)
-		d[i] = s[i];
+	/* 
+	 * Words can only be moved if both sides reach a word boundary together, which 
+	 * fields at odd offsets, such as those in the MBR, don't.
+	 */
+	if (addresses_mutually_aligned(s, d)) {
+		for (; n > 0 && !address_aligned(d, 4); --n)
+			*d++ = *s++;
+		nbursts = n&~(MEM_BURST_SZ-1);
+		if (nbursts) {
+			mcopy_bursts(s, d, nbursts);
+			s += nbursts;
+			d += nbursts;
+			n -= nbursts;
+		}
+		for (; n >= 4; n -= 4, s += 4, d += 4)
+			*(uint32_t *)d = *(uint32_t *)s;
+	}
+	for (; n > 0; --n)
+		*d++ = *s++;
 }
 
 bool mcmp(void *mem1, void *mem2, int n)
@@ -37,8 +81,18 @@ bool mcmp(void *mem1, void *mem2, int n)
 	byte_t *b1 = mem1;
 	byte_t *b2 = mem2;
 
-	for (int i = 0; i < n; ++i) {
-		if (b1[i] != b2[i])
+	if (addresses_mutually_aligned(b1, b2)) {
+		for (; n > 0 && !address_aligned(b1, 4); --n) {
+			if (*b1++ != *b2++)
+				return false;
+		}
+		for (; n >= 4; n -= 4, b1 += 4, b2 += 4) {
+			if (*(uint32_t *)b1 != *(uint32_t *)b2)
+				return false;
+		}
+	}
+	for (; n > 0; --n) {
+		if (*b1++ != *b2++)
 			return false;
 	}
 	return true;
@@ -66,5 +120,7 @@ void while_cond_timeout_infinite(bool (*condition)(void), int timeout_ms)
 	while (condition()) {
 		if (timer_poll_done(ts))
 			signal_error(ERROR_INFINITE_LOOP);
+		/* Check again at the next event rather than hammering the peripheral bus. */
+		timer_wait_event();
 	}
 }
@@ -7,7 +7,10 @@
 #include "timer.h"
 #include "sd/cmd.h"
 #include "bits.h"
+#include "gic.h"
 
+#if !ENABLE_GIC
+/* The legacy interrupt controller's pending IRQ status, only read when not using the GIC. */
 enum arm_local_register {
 	IRQ_SOURCE0
 };
@@ -21,6 +24,7 @@ static struct periph_access arm_local_access = {
 
 /* IRQ_SOURCE[0-3] register fields. */
 #define IRQ_SOURCE_CORE_IRQ  BIT(8)
+#endif
 
 
 enum armc_register {
@@ -50,11 +54,13 @@ static struct periph_access armc_access = {
 	}
 };
 
+#if !ENABLE_GIC
 /* IRQ[0-3]_PENDING2 register fields. */
 /* Interrupt is a VideoCore interrupt in range 31 to 0. */
 #define IRQ_PENDING2_INT31_0   BIT(24)
 /* Interrupt is a VideoCore interrupt in range 63 to 32. */
 #define IRQ_PENDING2_INT63_32  BIT(25)
+#endif
 
 /* 
  * Register fields for registers IRQ[0-3]_SET_EN_0, 
@@ -90,6 +96,7 @@ void ic_disable_interrupts(void)
 	register_set(&armc_access, IRQ0_CLR_EN_1, IRQ_INT63_32_EMMC2);
 }
 
+#if !ENABLE_GIC
 static enum irq get_irq_source(void)
 {
 	/* 
@@ -109,10 +116,29 @@ static enum irq get_irq_source(void)
 	}
 	return IRQ_UNIMPLEMENTED;
 }
+#else
+/** @brief Get the interrupt request of a GIC interrupt ID. */
+static enum irq gic_intid_to_irq(uint32_t intid)
+{
+	switch (intid) {
+		case GIC_INTID_TIMER1:
+			return IRQ_VC_TIMER1;
+		case GIC_INTID_EMMC2:
+			return IRQ_VC_EMMC2;
+		default:
+			return IRQ_UNIMPLEMENTED;
+	}
+}
+#endif
 
 void ic_irq_exception_handler(void)
 {
+#if ENABLE_GIC
+	uint32_t ack = gic_acknowledge_irq();
+	enum irq irq = gic_intid_to_irq(gic_intid(ack));
+#else
 	enum irq irq = get_irq_source();
+#endif
 
 	switch (irq) {
 		case IRQ_VC_TIMER1:
@@ -128,4 +154,9 @@ void ic_irq_exception_handler(void)
 		case IRQ_UNIMPLEMENTED:
 			break;
 	}
+#if ENABLE_GIC
+	/* A spurious interrupt wasn't acknowledged, so doesn't get ended. */
+	if (gic_intid(ack) != GIC_INTID_SPURIOUS)
+		gic_end_irq(ack);
+#endif
 }
@@ -3,7 +3,8 @@
  * SPDX-License-Identifier: GPL-2.0
  *
  * The legacy interrupt controller.
- * Usable only if enable_gic=0 in config.txt.
+ * Usable only if enable_gic=0 in config.txt. The IRQ exception handler
+ * is used with either interrupt controller.
  */
 #ifndef IC_H
 #define IC_H
@@ -17,6 +17,14 @@ void enable_interrupts(void)
 		"pop {r4}");
 }
 
+bool interrupts_enabled(void)
+{
+	uint32_t cpsr;
+
+	__asm__ volatile("mrs %0, cpsr" : "=r" (cpsr));
+	return !(cpsr&CPSR_I);
+}
+
 void disable_interrupts(void)
 {
 	__asm__("push {r4}\n\t"
@@ -5,7 +5,11 @@
 #ifndef INT_H
 #define INT_H
 
+#include "type.h"
+
 void enable_interrupts(void);
 void disable_interrupts(void);
+/** @brief Get whether IRQs are unmasked on this core. */
+bool interrupts_enabled(void);
 
 #endif
@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2023 Petar Turukalo
+ * SPDX-License-Identifier: GPL-2.0
+ *
+ * Implements the LZ4 block format, as described in lz4_Block_format.md
+ * of the LZ4 project.
+ */
+#include "lz4.h"
+#include "help.h"
+
+/* Shortest match, which a token's match length counts from. */
+#define MIN_MATCH 4
+/* Token length field value which means the length continues in the following bytes. */
+#define TOKEN_LEN_MORE 15
+
+/**
+ * @brief Read the continuation of a token length field, adding it to the length.
+ * @return Whether the continuation ended before the end of the block.
+ */
+static bool read_len(uint8_t **in, uint8_t *in_end, int *len)
+{
+	uint8_t byte;
+
+	do {
+		if (*in == in_end)
+			return false;
+		byte = *(*in)++;
+		*len += byte;
+	} while (byte == 255);
+	return true;
+}
+
+int lz4_decompress(void *src, int srcsz, void *dest, int destsz)
+{
+	uint8_t *in = src, *in_end = in+srcsz;
+	uint8_t *out = dest, *out_end = out+destsz;
+	uint8_t *match;
+	uint8_t token;
+	int len, off;
+
+	/* Each sequence is literals followed by a match, except the last, which has no match. */
+	while (in < in_end) {
+		token = *in++;
+
+		len = token>>4;
+		if (len == TOKEN_LEN_MORE && !read_len(&in, in_end, &len))
+			return -1;
+		if (len > in_end-in || len > out_end-out)
+			return -1;
+		mcopy(in, out, len);
+		in += len;
+		out += len;
+		if (in == in_end)
+			break;
+
+		if (in_end-in < 2)
+			return -1;
+		off = in[0] | in[1]<<8;
+		in += 2;
+		if (!off || off > out-(uint8_t *)dest)
+			return -1;
+		len = token&0xf;
+		if (len == TOKEN_LEN_MORE && !read_len(&in, in_end, &len))
+			return -1;
+		len += MIN_MATCH;
+		if (len > out_end-out)
+			return -1;
+		match = out-off;
+		/* 
+		 * A match closer than its length overlaps what it's copying to, repeating
+		 * the bytes it has just copied, so has to be copied a byte at a time.
+		 */
+		if (off < len) {
+			while (len--)
+				*out++ = *match++;
+		} else {
+			mcopy(match, out, len);
+			out += len;
+		}
+	}
+	return out-(uint8_t *)dest;
+}
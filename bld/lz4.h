@@ -0,0 +1,27 @@
+/*
+ * Copyright (C) 2023 Petar Turukalo
+ * SPDX-License-Identifier: GPL-2.0
+ *
+ * Decompression of LZ4 blocks, the format the imager compresses items
+ * with. Only touches memory, so it can be run from any core.
+ */
+#ifndef LZ4_H
+#define LZ4_H
+
+#include "type.h"
+
+/**
+ * @brief Decompress an LZ4 block.
+ *
+ * @param src Compressed block
+ * @param srcsz Size of the compressed block in bytes
+ * @param dest Where to decompress the block to
+ * @param destsz Size of the memory at dest in bytes, which the block isn't 
+ *		 decompressed past
+ *
+ * @return The size of the decompressed block in bytes, or -1 if the block is 
+ *	   malformed or decompresses to more than destsz bytes.
+ */
+int lz4_decompress(void *src, int srcsz, void *dest, int destsz);
+
+#endif
@@ -0,0 +1,150 @@
+/*
+ * Copyright (C) 2023 Petar Turukalo
+ * SPDX-License-Identifier: GPL-2.0
+ *
+ * Implements the short-descriptor translation table format from section
+ * 'B3.5 Short-descriptor translation table format' of the ARMv7-A 
+ * Architecture Reference Manual.
+ */
+#include "mmu.h"
+#include "addrmap.h"
+#include "mmio.h"
+#include "bits.h"
+
+/* Each first level descriptor maps a 1 MiB section, so 4096 of them cover 4 GiB. */
+#define SECTION_SHIFT 20
+#define NSECTIONS 4096
+/* Sections of RAM mapped, everything up to the end of the heap. */
+#define RAM_NSECTIONS (HEAP_END_RAM_ADDR>>SECTION_SHIFT)
+
+/* First level section descriptor fields. */
+#define SECT_TYPE_SECTION BIT(1)
+#define SECT_B            BIT(2)
+#define SECT_C            BIT(3)
+#define SECT_XN           BIT(4)   /* Execute never. */
+#define SECT_AP_RW        (0b11<<10)  /* Read/write at PL0 and PL1. */
+#define SECT_TEX_SHIFT    12
+#define SECT_S            BIT(16)  /* Shareable. */
+
+/* Normal memory, inner and outer write-back write-allocate cacheable. */
+#define SECT_NORMAL_WB (SECT_TYPE_SECTION|SECT_AP_RW|(0b001<<SECT_TEX_SHIFT)|SECT_C|SECT_B|SECT_S)
+/* Shareable device memory. Instructions are never fetched from it. */
+#define SECT_DEVICE (SECT_TYPE_SECTION|SECT_AP_RW|SECT_B|SECT_XN)
+
+/* Domain access control register: domain 0 (the only one used) is a client, checked against AP. */
+#define DACR_D0_CLIENT 0b01
+
+/* TTBR0 table walk attributes: inner and outer write-back write-allocate, shareable. */
+#define TTBR0_IRGN_WBWA BIT(6)
+#define TTBR0_RGN_WBWA  (0b01<<3)
+#define TTBR0_S         BIT(1)
+
+/* System control register fields. */
+#define SCTLR_M BIT(0)   /* MMU enable. */
+#define SCTLR_C BIT(2)   /* Data and unified cache enable. */
+#define SCTLR_Z BIT(11)  /* Branch prediction enable. */
+#define SCTLR_I BIT(12)  /* Instruction cache enable. */
+
+/* Cache type register field: log2 of the number of words in the smallest data cache line. */
+#define CTR_DMINLINE	   BITS(19, 16)
+#define CTR_DMINLINE_SHIFT 16
+
+static void build_translation_table(uint32_t *table)
+{
+	int i;
+
+	for (i = 0; i < NSECTIONS; ++i) {
+		if (i < RAM_NSECTIONS)
+			table[i] = (i<<SECTION_SHIFT)|SECT_NORMAL_WB;
+		else if (i >= ARM_LO_MAIN_PERIPH_BASE_ADDR>>SECTION_SHIFT)
+			table[i] = (i<<SECTION_SHIFT)|SECT_DEVICE;
+		else
+			table[i] = 0;  /* Translation fault. */
+	}
+}
+
+void mmu_enable(void)
+{
+	build_translation_table((uint32_t *)MMU_TABLE_ADDR);
+	mmu_enable_secondary();
+}
+
+void mmu_enable_secondary(void)
+{
+	uint32_t table = MMU_TABLE_ADDR;
+	uint32_t sctlr;
+
+	/* 
+	 * Discard any stale instruction cache, branch predictor and TLB entries, then 
+	 * point the MMU at the table with short descriptors (TTBCR 0) and all of it 
+	 * translated through TTBR0. The table is written uncached so it's already in RAM.
+	 */
+	__asm__ volatile("mcr p15, 0, %0, c7, c5, 0\n\t"   /* ICIALLU. */
+			 "mcr p15, 0, %0, c7, c5, 6\n\t"   /* BPIALL. */
+			 "mcr p15, 0, %0, c8, c7, 0\n\t"   /* TLBIALL. */
+			 "mcr p15, 0, %0, c2, c0, 2\n\t"   /* TTBCR. */
+			 "mcr p15, 0, %1, c3, c0, 0\n\t"   /* DACR. */
+			 "mcr p15, 0, %2, c2, c0, 0\n\t"   /* TTBR0. */
+			 "dsb\n\t"
+			 "isb"
+			 : 
+			 : "r" (0), "r" (DACR_D0_CLIENT), 
+			   "r" (table|TTBR0_IRGN_WBWA|TTBR0_RGN_WBWA|TTBR0_S));
+
+	__asm__ volatile("mrc p15, 0, %0, c1, c0, 0" : "=r" (sctlr));
+	sctlr |= SCTLR_M|SCTLR_C|SCTLR_Z|SCTLR_I;
+	__asm__ volatile("mcr p15, 0, %0, c1, c0, 0\n\t"
+			 "isb"
+			 : 
+			 : "r" (sctlr));
+}
+
+static uint32_t dcache_line_size(void)
+{
+	uint32_t ctr;
+
+	__asm__ volatile("mrc p15, 0, %0, c0, c0, 1" : "=r" (ctr));
+	return 4<<((ctr&CTR_DMINLINE)>>CTR_DMINLINE_SHIFT);
+}
+
+enum dcache_op {
+	DCACHE_OP_CLEAN,
+	DCACHE_OP_INVALIDATE,
+	DCACHE_OP_CLEAN_INVALIDATE
+};
+
+/** @brief Do a data cache operation to the point of coherency on each line of a range. */
+static void dcache_range(enum dcache_op op, void *addr, uint32_t size)
+{
+	uint32_t line = dcache_line_size();
+	uint32_t start = (uint32_t)addr, end = start+size;
+	uint32_t mva;
+
+	for (mva = start&~(line-1); mva < end; mva += line) {
+		/* A line partly outside the range might hold dirty data that isn't ours to discard. */
+		if (op == DCACHE_OP_INVALIDATE && (mva < start || mva+line > end))
+			__asm__ volatile("mcr p15, 0, %0, c7, c14, 1" : : "r" (mva));  /* DCCIMVAC. */
+		else if (op == DCACHE_OP_INVALIDATE)
+			__asm__ volatile("mcr p15, 0, %0, c7, c6, 1" : : "r" (mva));   /* DCIMVAC. */
+		else if (op == DCACHE_OP_CLEAN)
+			__asm__ volatile("mcr p15, 0, %0, c7, c10, 1" : : "r" (mva));  /* DCCMVAC. */
+		else
+			__asm__ volatile("mcr p15, 0, %0, c7, c14, 1" : : "r" (mva));  /* DCCIMVAC. */
+	}
+	__asm__ volatile("dsb");
+}
+
+void dcache_clean_range(void *addr, uint32_t size)
+{
+	dcache_range(DCACHE_OP_CLEAN, addr, size);
+}
+
+void dcache_invalidate_range(void *addr, uint32_t size)
+{
+	dcache_range(DCACHE_OP_INVALIDATE, addr, size);
+}
+
+void dcache_clean_invalidate_range(void *addr, uint32_t size)
+{
+	dcache_range(DCACHE_OP_CLEAN_INVALIDATE, addr, size);
+}
@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2023 Petar Turukalo
+ * SPDX-License-Identifier: GPL-2.0
+ *
+ * Memory management unit (MMU) and caches. The address space is identity 
+ * mapped (virtual addresses equal physical addresses) with a short-descriptor
+ * translation table of 1 MiB sections, so that RAM can be marked cacheable.
+ * With the MMU off every access, instruction fetches aside, is uncached.
+ */
+#ifndef MMU_H
+#define MMU_H
+
+#include "type.h"
+
+/**
+ * @brief Build the translation table and enable the MMU, data and instruction 
+ *	  caches, and branch prediction.
+ *
+ * The first 1 GiB of RAM, which holds everything the bootloader uses (see
+ * addrmap.h), is mapped as normal write-back cacheable memory, and the 
+ * peripherals from ARM_LO_MAIN_PERIPH_BASE_ADDR as device memory. Everything 
+ * else is left unmapped. They're turned off again by _boot_kernel in entry.S 
+ * before jumping to the kernel, which expects them off.
+ */
+void mmu_enable(void);
+/**
+ * @brief Enable the MMU, caches and branch prediction on a secondary core, using the
+ *	  translation table already built by the primary core's mmu_enable(). The 
+ *	  ARM stub has already made the core coherent with the others (CPUECTLR.SMPEN),
+ *	  and RAM is mapped shareable, so the cores see each other's cached writes.
+ */
+void mmu_enable_secondary(void);
+
+/**
+ * @defgroup dcache_range_fns
+ * @brief Maintain the data cache over a range of RAM shared with something that 
+ *	  doesn't go through it, such as the host controller's DMA or the VideoCore.
+ *
+ * Clean writes dirty lines back to RAM, to be done before the other side reads 
+ * the range. Invalidate discards lines, to be done after the other side writes the
+ * range, so that the CPU reads what was written instead of stale cached data. A 
+ * line only partly in the range is cleaned as well as invalidated so that data 
+ * outside the range isn't lost.
+ * @{
+ */
+void dcache_clean_range(void *addr, uint32_t size);
+void dcache_invalidate_range(void *addr, uint32_t size);
+void dcache_clean_invalidate_range(void *addr, uint32_t size);
+/** @} */
+
+#endif
@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2023 Petar Turukalo
+ * SPDX-License-Identifier: GPL-2.0
+ */
+#include "sched.h"
+#include "error.h"
+#include "debug.h"
+#include "timer.h"
+
+/* 
+ * How long to sleep after a pass that only found pending steps, instead of straight
+ * away polling the hardware they're waiting on again. Pending steps pace their polls 
+ * in milliseconds, so this delays them little.
+ */
+#define SCHED_IDLE_US 200
+
+void sched_run(struct step *steps, int nsteps)
+{
+	uint32_t done = 0;
+	int ndone = 0;
+	bool ran, progressed;
+	int i;
+
+	if (nsteps > SCHED_MAX_STEPS) {
+		serial_log("Error: %u steps is more than the max %u", nsteps, SCHED_MAX_STEPS);
+		signal_error(ERROR_STEP_DEPS);
+	}
+	while (ndone < nsteps) {
+		ran = false;
+		progressed = false;
+		for (i = 0; i < nsteps; ++i) {
+			if (done&STEP_DEP(i) || (steps[i].deps&~done))
+				continue;
+			ran = true;
+			if (steps[i].run() == STEP_STATUS_DONE) {
+				done |= STEP_DEP(i);
+				++ndone;
+				progressed = true;
+			}
+		}
+		log_drain();
+		/* Every step left is waiting on another which isn't done, so none ever will be. */
+		if (!ran) {
+			for (i = 0; i < nsteps; ++i) {
+				if (!(done&STEP_DEP(i))) {
+					serial_log("Error: step %s can't run: dependencies %08x, "
+						   "done steps %08x", steps[i].name, steps[i].deps, done);
+				}
+			}
+			signal_error(ERROR_STEP_DEPS);
+		}
+		if (!progressed)
+			usleep(SCHED_IDLE_US);
+	}
+}
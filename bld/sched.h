@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2023 Petar Turukalo
+ * SPDX-License-Identifier: GPL-2.0
+ *
+ * Cooperative scheduler for running initialisation as resumable steps.
+ * A step that would otherwise sit waiting on hardware instead returns 
+ * pending, and is run again later, so that other steps which are ready 
+ * can run in the meantime.
+ */
+#ifndef SCHED_H
+#define SCHED_H
+
+#include "type.h"
+#include "bits.h"
+
+/** @brief Maximum number of steps, limited by the width of the dependency bitmask. */
+#define SCHED_MAX_STEPS 32
+
+enum step_status {
+	STEP_STATUS_DONE,
+	/** Waiting on hardware: run the step again once the other ready steps have had a go. */
+	STEP_STATUS_PENDING
+};
+
+/**
+ * @brief A resumable step.
+ *
+ * @var step::run
+ * Do as much of the step as can be done without waiting on hardware. Is run
+ * again while it returns STEP_STATUS_PENDING. Errors are handled by the step 
+ * itself, which should signal_error() on fatal ones.
+ *
+ * @var step::deps
+ * Bitmask of the steps which must be done before this one is first run, where
+ * a step is identified by its index in the step array (see STEP_DEP()).
+ */
+struct step {
+	char *name;
+	enum step_status (*run)(void);
+	uint32_t deps;
+};
+
+/** @brief Get the dependency bitmask bit for the step at an index in the step array. */
+#define STEP_DEP(idx) BIT(idx)
+
+/**
+ * @brief Run steps until all of them are done, in array order among the steps whose 
+ *	  dependencies are done, going around again while any are still pending. A
+ *	  pass where no step got done sleeps before the next, rather than spinning.
+ *	  Since steps run in array order, a step that goes pending should come before
+ *	  the steps that are meant to run while it's pending.
+ *
+ * Signal error with error ERROR_STEP_DEPS if the steps' dependencies can't be satisfied.
+ */
+void sched_run(struct step *steps, int nsteps);
+
+#endif
@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 2023 Petar Turukalo
+ * SPDX-License-Identifier: GPL-2.0
+ *
+ * Implements section '1.13 Advanced DMA' of the SD Host Controller
+ * Specification Version 3.00.
+ */
+#include "adma.h"
+#include "reg.h"
+#include "../heap.h"
+#include "../addrmap.h"
+#include "../help.h"
+#include "../mmu.h"
+#include "sd_blksz.h"
+
+/**
+ * Offset to add to an ARM physical address to get the address of the same RAM
+ * as seen by the EMMC2 host controller's DMA. This comes from the dma-ranges
+ * property of the BCM2711 RPI 4 B device tree /emmc2bus node, which maps EMMC2
+ * bus addresses 0xc0000000 onwards to the first 1 GiB of RAM. This means RAM
+ * above 1 GiB can't be a DMA destination, but the bootloader doesn't use it.
+ */
+#define EMMC2_DMA_BUS_ADDR_OFF 0xc0000000
+
+/**
+ * @brief ADMA2 descriptor, for 32-bit addressing.
+ *
+ * @var adma2_descriptor::valid
+ * Whether this is a valid descriptor. The host controller stops with an ADMA
+ * error if it fetches an invalid descriptor.
+ *
+ * @var adma2_descriptor::end
+ * Whether this is the last descriptor in the table.
+ *
+ * @var adma2_descriptor::length
+ * Number of bytes to transfer to address. Must be a multiple of 4.
+ *
+ * @var adma2_descriptor::address
+ * 4-byte aligned bus address of the data to transfer (or of the next descriptor
+ * if the action is link).
+ */
+struct adma2_descriptor {
+	bits_t valid : 1;
+	bits_t end : 1;
+	bits_t interrupt : 1;
+	bits_t reserved1 : 1;
+	enum {
+		ADMA2_ACT_NOP  = 0b00,
+		ADMA2_ACT_TRAN = 0b10,  /**< Transfer data. */
+		ADMA2_ACT_LINK = 0b11   /**< Link to another descriptor. */
+	} act : 2;
+	bits_t reserved2 : 10;
+	bits_t length : 16;
+	uint32_t address;
+} __attribute__((packed));
+
+/*
+ * Largest number of bytes a single descriptor transfers. The length field is 16 bits
+ * wide, so the largest multiple of SD_BLKSZ that fits is used, which keeps every
+ * descriptor's address block aligned relative to the start of the transfer.
+ */
+#define ADMA2_DESC_MAX_LEN (UINT16_MAX+1-SD_BLKSZ)
+/* 
+ * Enough descriptors for a transfer into all of the RAM the host controller's DMA
+ * can reach, so the table never overflows.
+ */
+#define ADMA2_TABLE_NDESCS (HEAP_END_RAM_ADDR/ADMA2_DESC_MAX_LEN+1)
+
+static struct adma2_descriptor *table;
+
+bool adma2_select(void)
+{
+	if (!(register_get(&sd_access, CAPABILITIES0)&CAPABILITIES0_ADMA2_SUPPORT))
+		return false;
+	/* Kept for good: only allocated the first time. */
+	if (!table) {
+		table = heap_alloc(ADMA2_TABLE_NDESCS*sizeof(struct adma2_descriptor), 
+				   HEAP_ALIGN_DMA);
+	}
+	register_disable_bits(&sd_access, CONTROL0, CONTROL0_DMA_SEL);
+	register_enable_bits(&sd_access, CONTROL0, CONTROL0_DMA_SEL_ADMA2_32BIT);
+	return true;
+}
+
+bool adma2_selected(void)
+{
+	return (register_get(&sd_access, CONTROL0)&CONTROL0_DMA_SEL) == CONTROL0_DMA_SEL_ADMA2_32BIT;
+}
+
+void adma2_set_table(byte_t *ram_dest_addr, uint32_t bytes)
+{
+	struct adma2_descriptor *desc = table;
+	uint32_t len;
+
+	/* 
+	 * Write back and discard any cached lines of the destination now, so none are
+	 * evicted over the data the host controller writes to RAM.
+	 */
+	dcache_clean_invalidate_range(ram_dest_addr, bytes);
+
+	/*
+	 * Chain as many descriptors as needed to cover the whole transfer, so a single
+	 * read command isn't limited in size by the descriptor length field.
+	 */
+	do {
+		len = bytes < ADMA2_DESC_MAX_LEN ? bytes : ADMA2_DESC_MAX_LEN;
+
+		mzero(desc, sizeof(struct adma2_descriptor));
+		desc->valid = true;
+		desc->act = ADMA2_ACT_TRAN;
+		desc->length = len;
+		desc->address = (uint32_t)ram_dest_addr + EMMC2_DMA_BUS_ADDR_OFF;
+
+		ram_dest_addr += len;
+		bytes -= len;
+		++desc;
+	} while (bytes);
+	(desc-1)->end = true;
+
+	/*
+	 * The clean, along with the write barrier in register_set(), makes sure the 
+	 * table is in RAM before the host controller can fetch it.
+	 */
+	dcache_clean_range(table, (byte_t *)desc-(byte_t *)table);
+	register_set(&sd_access, ADMA_SYS_ADDR, (uint32_t)table + EMMC2_DMA_BUS_ADDR_OFF);
+}
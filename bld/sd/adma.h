@@ -0,0 +1,34 @@
+/*
+ * Copyright (C) 2023 Petar Turukalo
+ * SPDX-License-Identifier: GPL-2.0
+ *
+ * ADMA2 (advanced DMA version 2) data transfer between the SD host
+ * controller and RAM, where the host controller copies read data into
+ * RAM itself instead of the CPU draining it out of the DATA register.
+ */
+#ifndef ADMA_H
+#define ADMA_H
+
+#include "../type.h"
+
+/**
+ * @brief Select 32-bit ADMA2 as the host controller's DMA mode.
+ * @return Whether the host controller supports ADMA2 (and so whether it was selected).
+ */
+bool adma2_select(void);
+/** @brief Get whether 32-bit ADMA2 is the host controller's selected DMA mode. */
+bool adma2_selected(void);
+
+/**
+ * @brief Build the descriptor table for a transfer of a number of bytes into RAM,
+ *	  and point the host controller at it. The next data transfer command issued
+ *	  with DMA enabled will transfer its data as described by the table.
+ *
+ * @param ram_dest_addr 4-byte aligned destination address in RAM to copy read data to
+ *
+ * The destination must be invalidated from the data cache with dcache_invalidate_range()
+ * once the transfer has finished, before reading it.
+ */
+void adma2_set_table(byte_t *ram_dest_addr, uint32_t bytes);
+
+#endif
@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2023 Petar Turukalo
+ * SPDX-License-Identifier: GPL-2.0
+ */
+#include "cache.h"
+#include "sd.h"
+#include "../heap.h"
+#include "../help.h"
+#include "sd_blksz.h"
+
+/* 
+ * Number of blocks read into the cache on a cache miss, starting at the first 
+ * missed block. Reads of this many blocks or more bypass the cache.
+ */
+#define CACHE_NBLKS 64  /* 32 KiB. */
+
+/**
+ * @brief The cache holds one window of consecutive blocks, which is replaced
+ *	  on each cache miss. The SD card is only read, so it never goes stale.
+ *
+ * @var block_cache::nblks
+ * Number of blocks in the window starting at lba, or 0 if the cache is empty.
+ */
+static struct block_cache {
+	byte_t *blocks;
+	uint32_t lba;
+	int nblks;
+} cache;
+
+static byte_t *cache_block_address(uint32_t lba)
+{
+	return cache.blocks + (lba-cache.lba)*SD_BLKSZ;
+}
+
+/**
+ * @brief Copy the blocks at the start of a read which are in the cache.
+ * @return Number of blocks copied.
+ */
+static int cache_copy_hits(byte_t *ram_dest_addr, uint32_t sd_src_lba, int nblks)
+{
+	int hits;
+
+	if (sd_src_lba < cache.lba || sd_src_lba >= cache.lba+cache.nblks)
+		return 0;
+	hits = min(nblks, cache.lba+cache.nblks-sd_src_lba);
+	mcopy(cache_block_address(sd_src_lba), ram_dest_addr, hits*SD_BLKSZ);
+	return hits;
+}
+
+/** @brief Get whether the cache window starting at a block runs past the end of the card. */
+static bool cache_window_past_end(uint32_t sd_src_lba)
+{
+	/* Compared this way round so that the end of the window can't wrap. */
+	return sd_nblks() < CACHE_NBLKS || sd_src_lba > sd_nblks()-CACHE_NBLKS;
+}
+
+/**
+ * @brief Replace the cache window with the window starting at a block.
+ * @return Whether the window was read, otherwise the cache is left empty.
+ */
+static bool cache_fill(uint32_t sd_src_lba)
+{
+	cache.nblks = 0;
+	/* Kept for good: only allocated on the first fill. */
+	if (!cache.blocks)
+		cache.blocks = heap_alloc(CACHE_NBLKS*SD_BLKSZ, HEAP_ALIGN_DMA);
+	if (!sd_read_blocks(cache.blocks, sd_src_lba, CACHE_NBLKS))
+		return false;
+	cache.lba = sd_src_lba;
+	cache.nblks = CACHE_NBLKS;
+	return true;
+}
+
+/**
+ * @brief Read blocks through the cache, using read to read blocks which either
+ *	  miss it and are too many to cache, or are past the end of the card.
+ */
+static bool cache_read(byte_t *ram_dest_addr, uint32_t sd_src_lba, int nblks,
+		       bool (*read)(byte_t *, uint32_t, int))
+{
+	int hits = cache_copy_hits(ram_dest_addr, sd_src_lba, nblks);
+
+	ram_dest_addr += hits*SD_BLKSZ;
+	sd_src_lba += hits;
+	nblks -= hits;
+
+	if (!nblks)
+		return true;
+	if (nblks >= CACHE_NBLKS)
+		return read(ram_dest_addr, sd_src_lba, nblks);
+	/* 
+	 * The window can't be read if it runs past the end of the card, in which
+	 * case just read the blocks asked for. Any other failure is a read error.
+	 */
+	if (cache_window_past_end(sd_src_lba))
+		return read(ram_dest_addr, sd_src_lba, nblks);
+	if (!cache_fill(sd_src_lba))
+		return false;
+	cache_copy_hits(ram_dest_addr, sd_src_lba, nblks);
+	return true;
+}
+
+bool sd_cache_read_blocks(byte_t *ram_dest_addr, uint32_t sd_src_lba, int nblks)
+{
+	return cache_read(ram_dest_addr, sd_src_lba, nblks, sd_read_blocks);
+}
+
+bool sd_cache_read_submit(byte_t *ram_dest_addr, uint32_t sd_src_lba, int nblks)
+{
+	return cache_read(ram_dest_addr, sd_src_lba, nblks, sd_read_submit);
+}
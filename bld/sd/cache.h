@@ -0,0 +1,27 @@
+/*
+ * Copyright (C) 2023 Petar Turukalo
+ * SPDX-License-Identifier: GPL-2.0
+ *
+ * Block cache in front of SD reads. A small read is widened into a read
+ * of the blocks following it too, so that the following small reads of
+ * adjacent blocks, e.g. the image head then the first block of the first
+ * item, are copied out of RAM instead of each costing its own SD read.
+ */
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "../type.h"
+
+/**
+ * @brief Read blocks as in sd_read_blocks(), but through the block cache.
+ *	  Requires there be no submitted read in flight.
+ */
+bool sd_cache_read_blocks(byte_t *ram_dest_addr, uint32_t sd_src_lba, int nblks);
+/**
+ * @brief Read blocks as in sd_read_submit(), but through the block cache.
+ *	  Blocks found in the cache are copied before this returns, and only 
+ *	  the rest are submitted. Wait for the read with sd_read_wait().
+ */
+bool sd_cache_read_submit(byte_t *ram_dest_addr, uint32_t sd_src_lba, int nblks);
+
+#endif
@@ -4,9 +4,11 @@
  */
 #include "cmd.h"
 #include "reg.h"
+#include "adma.h"
 #include "../help.h"
 #include "../timer.h"
 #include "../debug.h"
+#include "../mmu.h"
 #include "sd_blksz.h"
 
 /**
@@ -49,16 +51,44 @@ static struct command commands[] = {
 	{ CMD_IDX_GO_IDLE_STATE,       CMD_TYPE_BC,   CMD_RESPONSE_NONE },
 	{ CMD_IDX_ALL_SEND_CID,        CMD_TYPE_BCR,  CMD_RESPONSE_R2_CID_OR_CSD_REG },
 	{ CMD_IDX_SEND_RELATIVE_ADDR,  CMD_TYPE_BCR,  CMD_RESPONSE_R6_PUBLISHED_RCA },
+	{ CMD_IDX_SWITCH_FUNC,         CMD_TYPE_ADTC, CMD_RESPONSE_R1_NORMAL },
 	{ CMD_IDX_SELECT_CARD,         CMD_TYPE_AC,   CMD_RESPONSE_R1B_NORMAL_BUSY },
 	{ CMD_IDX_SEND_IF_COND,        CMD_TYPE_BCR,  CMD_RESPONSE_R7_CARD_INTERFACE_CONDITION },
+	{ CMD_IDX_SEND_CSD,            CMD_TYPE_AC,   CMD_RESPONSE_R2_CID_OR_CSD_REG },
+	{ CMD_IDX_VOLTAGE_SWITCH,      CMD_TYPE_AC,   CMD_RESPONSE_R1_NORMAL },
+	{ CMD_IDX_STOP_TRANSMISSION,   CMD_TYPE_AC,   CMD_RESPONSE_R1B_NORMAL_BUSY },
 	{ CMD_IDX_SEND_STATUS,         CMD_TYPE_AC,   CMD_RESPONSE_R1_NORMAL },
 	{ CMD_IDX_READ_SINGLE_BLOCK,   CMD_TYPE_ADTC, CMD_RESPONSE_R1_NORMAL },
 	{ CMD_IDX_READ_MULTIPLE_BLOCK, CMD_TYPE_ADTC, CMD_RESPONSE_R1_NORMAL },
+	{ CMD_IDX_SEND_TUNING_BLOCK,   CMD_TYPE_ADTC, CMD_RESPONSE_R1_NORMAL },
 	{ CMD_IDX_SET_BLOCK_COUNT,     CMD_TYPE_AC,   CMD_RESPONSE_R1_NORMAL },
 	{ CMD_IDX_APP_CMD,             CMD_TYPE_AC,   CMD_RESPONSE_R1_NORMAL },
 	{ ACMD_IDX_SET_BUS_WIDTH,      CMD_TYPE_AC,   CMD_RESPONSE_R1_NORMAL },
 	{ ACMD_IDX_SD_SEND_OP_COND,    CMD_TYPE_BCR,  CMD_RESPONSE_R3_OCR_REG },
-	{ ACMD_IDX_SD_SEND_SCR,	       CMD_TYPE_ADTC, CMD_RESPONSE_R1_NORMAL }
+	{ ACMD_IDX_SD_SEND_SCR,	       CMD_TYPE_ADTC, CMD_RESPONSE_R1_NORMAL },
+	{ CMD_IDX_DESELECT_CARD,       CMD_TYPE_AC,   CMD_RESPONSE_NONE }
+};
+
+/**
+ * @brief Options for how a data transfer command transfers its data, which aren't
+ *	  fixed by the command itself and are instead chosen per transfer.
+ *
+ * @var transfer_opts::dma
+ * Transfer the data with ADMA2 as described by the table set with adma2_set_table(),
+ * instead of through the DATA register.
+ *
+ * @var transfer_opts::infinite
+ * Don't stop the transfer at the BLKSIZECNT block count, which is too narrow for some 
+ * transfers. The transfer is instead stopped by the end of the ADMA2 descriptor table.
+ *
+ * @var transfer_opts::auto_cmd
+ * Command for the host controller to issue automatically as part of a multiple block
+ * transfer. For AUTO_CMD_CMD23 the block count argument must already be set in ARG2.
+ */
+struct transfer_opts {
+	bool dma;
+	bool infinite;
+	enum auto_cmd auto_cmd;
 };
 
 static struct command *get_command(enum cmd_index idx)
@@ -125,28 +155,36 @@ static void set_cmdtm_idx_and_crc_chk(struct command *cmd, struct cmdtm *cmdtm)
 /**
  * Set the fields of the transfer mode register relevant to the command.
  * The transfer mode register is the lower 16 bits of cmdtm.
+ *
+ * @param opts Optional (nullable) transfer options
  */
-static void set_cmdtm_transfer_mode(struct command *cmd, struct cmdtm *cmdtm)
+static void set_cmdtm_transfer_mode(struct command *cmd, struct transfer_opts *opts, 
+				    struct cmdtm *cmdtm)
 {
 	/* As more commands are implemented they will need to be added in conditions here. */
 	if (cmd->index == CMD_IDX_READ_SINGLE_BLOCK || cmd->index == CMD_IDX_READ_MULTIPLE_BLOCK ||
-	    cmd->index == ACMD_IDX_SD_SEND_SCR)
+	    cmd->index == ACMD_IDX_SD_SEND_SCR || cmd->index == CMD_IDX_SWITCH_FUNC ||
+	    cmd->index == CMD_IDX_SEND_TUNING_BLOCK)
 		cmdtm->data_transfer_direction = CMDTM_TM_DAT_DIR_READ;
 	if (cmd->index == CMD_IDX_READ_MULTIPLE_BLOCK) {
-		cmdtm->block_cnt_en = true;
+		cmdtm->block_cnt_en = !(opts && opts->infinite);
 		cmdtm->multi_block = true;
+		if (opts)
+			cmdtm->auto_cmd_en = opts->auto_cmd;
 	}
+	if (opts)
+		cmdtm->dma_en = opts->dma;
 }
 
 /**
  * Set the fields of the cmdtm register required to issue the
  * given command.
  */
-static void set_cmdtm(struct command *cmd, struct cmdtm *cmdtm)
+static void set_cmdtm(struct command *cmd, struct transfer_opts *opts, struct cmdtm *cmdtm)
 {
 	mzero(cmdtm, sizeof(struct cmdtm));
 
-	cmdtm->cmd_index = cmd->index & ~IS_APP_CMD;
+	cmdtm->cmd_index = cmd->index & ~(IS_APP_CMD|IS_VARIANT_CMD);
 	set_cmdtm_response_type(cmd, cmdtm);
 	set_cmdtm_idx_and_crc_chk(cmd, cmdtm);
 	/* 
@@ -155,28 +193,75 @@ static void set_cmdtm(struct command *cmd, struct cmdtm *cmdtm)
 	 */
 	if (cmd->type == CMD_TYPE_ADTC)
 		cmdtm->data_present = true;
-	set_cmdtm_transfer_mode(cmd, cmdtm);
+	if (cmd->index == CMD_IDX_STOP_TRANSMISSION)
+		cmdtm->cmd_type = CMDTM_CMD_TYPE_ABORT;
+	set_cmdtm_transfer_mode(cmd, opts, cmdtm);
+}
+
+/* How long to wait for an interrupt before timing out. */
+#define IRPT_TIMEOUT_MS 500
+
+static enum cmd_error_kind last_error_kind;
+
+enum cmd_error_kind sd_last_error_kind(void)
+{
+	return last_error_kind;
+}
+
+/** @brief Get the kind of error of a triggered error interrupt. */
+static enum cmd_error_kind sd_error_interrupt_kind(struct interrupt irpt)
+{
+	uint32_t auto_cmd_errors = 0;
+
+	if (irpt.auto_cmd_error)
+		auto_cmd_errors = register_get(&sd_access, CONTROL2);
+
+	if (irpt.cmd_crc_error || irpt.cmd_end_bit_error || irpt.cmd_index_error ||
+	    irpt.data_crc_error || irpt.data_end_bit_error || 
+	    auto_cmd_errors&(CONTROL2_ACCRC_ERR|CONTROL2_ACEND_ERR|CONTROL2_ACBAD_ERR))
+		return CMD_ERROR_KIND_CRC;
+	if (irpt.cmd_timeout_error || irpt.data_timeout_error || auto_cmd_errors&CONTROL2_ACTO_ERR)
+		return CMD_ERROR_KIND_TIMEOUT;
+	return CMD_ERROR_KIND_OTHER;
 }
 
 /**
- * If the return is zero then timed out waiting for any interrupt.
+ * Get (and clear) whichever of the interrupts in a mask, or any error interrupt,
+ * are flagged, without waiting. If the return is zero then none are flagged.
  */
-static struct interrupt sd_wait_for_any_interrupt(void)
+static struct interrupt sd_get_any_interrupt(int interrupt_mask)
 {
-	timestamp_t ts;
 	struct interrupt irpt;
 
-	mzero(&irpt, sizeof(irpt));
+	register_get_out(&sd_access, INTERRUPT, &irpt);
+	/* 
+	 * Only pick up (and clear) the interrupts being waited for, so that another 
+	 * interrupt flagged at the same time, e.g. read ready straight after command 
+	 * complete, is left for a following wait instead of being lost.
+	 */
+	cast_bitfields(irpt, uint32_t) &= interrupt_mask|INTERRUPT_ERRORS;
 
-	ts = timer_poll_start(500);
-	do {
-		register_get_out(&sd_access, INTERRUPT, &irpt);
+	if (cast_bitfields(irpt, uint32_t)) {
+		/* Clear triggered interrupts. */
+		register_set_ptr(&sd_access, INTERRUPT, &irpt);
+	}
+	return irpt;
+}
 
-		if (cast_bitfields(irpt, uint32_t)) {
-			/* Clear triggered interrupts. */
-			register_set_ptr(&sd_access, INTERRUPT, &irpt);
+/**
+ * Wait for any of the interrupts in a mask, or any error interrupt, to be flagged. 
+ * If the return is zero then timed out waiting.
+ */
+static struct interrupt sd_wait_for_any_interrupt(int interrupt_mask, int timeout_ms)
+{
+	timestamp_t ts;
+	struct interrupt irpt;
+
+	ts = timer_poll_start(timeout_ms);
+	do {
+		irpt = sd_get_any_interrupt(interrupt_mask);
+		if (cast_bitfields(irpt, uint32_t))
 			break;
-		}
 		usleep(50);
 	} while (!timer_poll_done(ts));
 
@@ -184,34 +269,52 @@ static struct interrupt sd_wait_for_any_interrupt(void)
 }
 
 /**
- * @brief Wait for a particular interrupt. 
- * @param interrupt_mask Bit mask for the interrupt's field in the INTERRUPT register
+ * @brief Check whether a flagged interrupt (or error interrupt) is an error.
+ * @param irpt A non-zero return of sd_get_any_interrupt()
  */
-enum cmd_error sd_wait_for_interrupt(int interrupt_mask)
+static enum cmd_error sd_check_interrupt(struct interrupt irpt)
 {
-	struct interrupt irpt = sd_wait_for_any_interrupt();
-
-	if (!cast_bitfields(irpt, uint32_t)) {
-		serial_log("SD cmd error: timeout waiting for interrupt %08x", interrupt_mask);
-		return CMD_ERROR_WAIT_FOR_INTERRUPT_TIMEOUT;
-	}
 	if (irpt.error) {
-		/* 
-		 * Note might be worth checking which error it was and then retrying 
-		 * instead of failing. 
-		 */
+		/* Which error it was is kept for the caller to decide whether to retry. */
+		last_error_kind = sd_error_interrupt_kind(irpt);
 		serial_log("SD cmd error: error interrupt triggered: %08x", 
 			   cast_bitfields(irpt, uint32_t));
+		if (irpt.adma_error) 
+			serial_log("SD cmd error: ADMA error status %08x", 
+				   register_get(&sd_access, ADMA_ERR_STATUS));
+		if (irpt.auto_cmd_error) 
+			serial_log("SD cmd error: auto cmd error status %08x", 
+				   register_get(&sd_access, CONTROL2)&CONTROL2_AUTO_CMD_ERRORS);
 		return CMD_ERROR_INTERRUPT_ERROR;
 	}
-	if (!(cast_bitfields(irpt, uint32_t)&interrupt_mask)) {
-		serial_log("SD cmd error: expected interrupt %08x not triggered: %08x",
-			   interrupt_mask, cast_bitfields(irpt, uint32_t));
-		return CMD_ERROR_EXPECTED_INTERRUPT_NOT_TRIGGERED;
-	}
 	return CMD_ERROR_NONE;
 }
 
+/**
+ * @brief Wait for a particular interrupt, timing out after timeout_ms.
+ * @param interrupt_mask Bit mask for the interrupt's field in the INTERRUPT register
+ */
+static enum cmd_error sd_wait_for_interrupt_timeout(int interrupt_mask, int timeout_ms)
+{
+	struct interrupt irpt = sd_wait_for_any_interrupt(interrupt_mask, timeout_ms);
+
+	if (!cast_bitfields(irpt, uint32_t)) {
+		serial_log("SD cmd error: timeout waiting for interrupt %08x", interrupt_mask);
+		last_error_kind = CMD_ERROR_KIND_TIMEOUT;
+		return CMD_ERROR_WAIT_FOR_INTERRUPT_TIMEOUT;
+	}
+	return sd_check_interrupt(irpt);
+}
+
+/**
+ * @brief Wait for a particular interrupt. 
+ * @param interrupt_mask Bit mask for the interrupt's field in the INTERRUPT register
+ */
+enum cmd_error sd_wait_for_interrupt(int interrupt_mask)
+{
+	return sd_wait_for_interrupt_timeout(interrupt_mask, IRPT_TIMEOUT_MS);
+}
+
 static bool sd_cmd_has_card_status_response(struct command *cmd)
 {
 	return cmd->response == CMD_RESPONSE_R1_NORMAL ||
@@ -236,15 +339,22 @@ static bool sd_card_status_error_bit_set(struct card_status *cs)
  * command. IDX_SPEC_ARGS are the arguments used to expand the specifier. 
  */
 #define IDX_SPEC "%s%u"
-#define IDX_SPEC_ARGS(idx) idx&IS_APP_CMD ? "APP" : "", idx&~IS_APP_CMD
+#define IDX_SPEC_ARGS(idx) idx&IS_APP_CMD ? "APP" : "", idx&~(IS_APP_CMD|IS_VARIANT_CMD)
 
-enum cmd_error sd_issue_cmd(enum cmd_index idx, uint32_t args)
+/**
+ * @see sd_issue_cmd()
+ * @param opts Optional (nullable) transfer options, for data transfer commands
+ */
+static enum cmd_error _sd_issue_cmd(enum cmd_index idx, uint32_t args, struct transfer_opts *opts)
 {
 	struct command *cmd;
 	struct cmdtm cmdtm;
 	uint32_t status;
 	enum cmd_error error;
 
+	/* Overwritten below if it was a bus error. */
+	last_error_kind = CMD_ERROR_KIND_OTHER;
+
 	cmd = get_command(idx);
 	if (!cmd) {
 		serial_log("SD cmd error: command " IDX_SPEC " not implemented", IDX_SPEC_ARGS(idx));
@@ -256,18 +366,26 @@ enum cmd_error sd_issue_cmd(enum cmd_index idx, uint32_t args)
 			   IDX_SPEC_ARGS(idx));
 		return CMD_ERROR_COMMAND_INHIBIT_CMD_BIT_SET;
 	}
-	/* Note if implement an abort command such as CMD12 then need to let it skip this step. */
+	/* 
+	 * CMD12 is let through even though it's R1b, since it's issued to stop a transfer 
+	 * that's still using the DAT line.
+	 */
 	if ((cmd->type == CMD_TYPE_ADTC || cmd->response == CMD_RESPONSE_R1B_NORMAL_BUSY) && 
-	    status&STATUS_COMMAND_INHIBIT_DAT) {
+	    cmd->index != CMD_IDX_STOP_TRANSMISSION && status&STATUS_COMMAND_INHIBIT_DAT) {
 		serial_log("SD cmd error: command " IDX_SPEC " uses DAT line but DAT line already set", 
 			   IDX_SPEC_ARGS(idx));
 		return CMD_ERROR_COMMAND_INHIBIT_DAT_BIT_SET;
 	}
 
-	/* Set the command's arguments. Note if implement ACMD23 it needs to use ARG2 instead. */
+	/* 
+	 * Set the command's arguments. Note if implement ACMD23 it needs to use ARG2 instead,
+	 * as does an auto CMD23, which is set by its caller.
+	 */
 	register_set(&sd_access, ARG1, args);
+	/* Clear interrupts left flagged but not waited for by previous commands. */
+	register_set(&sd_access, INTERRUPT, ~0);
 
-	set_cmdtm(cmd, &cmdtm);
+	set_cmdtm(cmd, opts, &cmdtm);
 
 	/* Issue the command, which should trigger an interrupt. */
 	register_set_ptr(&sd_access, CMDTM, &cmdtm);
@@ -288,6 +406,11 @@ enum cmd_error sd_issue_cmd(enum cmd_index idx, uint32_t args)
 	return error;
 }
 
+enum cmd_error sd_issue_cmd(enum cmd_index idx, uint32_t args)
+{
+	return _sd_issue_cmd(idx, args, NULL);
+}
+
 enum cmd_error sd_issue_acmd(enum cmd_index idx, uint32_t args, int rca)
 {
 	struct ac_rca_args cmd55_args;
@@ -341,23 +464,28 @@ enum cmd_error sd_issue_cmd8(void)
 /* OCR register fields. */
 /* Voltage window. */
 #define OCR_VDD_2V7_TO_3V6		0x00ff8000
+/* Whether the card accepted switching to 1.8V signalling. */
+#define OCR_S18A			BIT(24)
 /* 0 is SDSC, 1 is SDHC/SDXC. */
 #define OCR_CARD_CAPACITY_STATUS	BIT(30)
 /* Whether card power up procedure has finished. */
 #define OCR_CARD_POWER_UP_STATUS	BIT(31)
 
 /* ACMD41 argument fields. */
+/* Request switching to 1.8V signalling. */
+#define ACMD41_S18R			BIT(24)
 /* Whether the host supports SDHC/SDXC. */
 #define ACMD41_HOST_CAPACITY_SUPPORT	BIT(30)
 
-enum cmd_error sd_issue_acmd41(bool *card_capacity_support_out)
+/* Milliseconds between asking the card whether it has finished powering up. */
+#define ACMD41_POLL_INTERVAL_MS 20
+
+enum cmd_error sd_start_acmd41(bool request_1v8, struct acmd41_poll *poll_out)
 {
 	uint32_t args, ocr;
 	enum cmd_error error;
-	timestamp_t ts;
 	/* Card has a default RCA of 0 when in idle state. */
 	int rca = 0;
-	int i = 0;
 
 	/* 
 	 * When args voltage window is zero ACMD41 is inquiry ACMD41. When args voltage window is 
@@ -380,24 +508,76 @@ enum cmd_error sd_issue_acmd41(bool *card_capacity_support_out)
 	/* Set args for init ACMD41. */
 	args |= OCR_VDD_2V7_TO_3V6;
 	args |= ACMD41_HOST_CAPACITY_SUPPORT;
+	if (request_1v8)
+		args |= ACMD41_S18R;
 
-	/* Wait for card to finish power up, which should take at most 1 second from the first init ACMD41. */
-	ts = timer_poll_start(1000);
-	do {
-		if (i++)
-			sleep(20);
-		error = sd_issue_acmd(ACMD_IDX_SD_SEND_OP_COND, args, rca);
-		if (error != CMD_ERROR_NONE)
-			return error;
-		ocr = register_get(&sd_access, RESP0);
-	} while (!(ocr&OCR_CARD_POWER_UP_STATUS) && !timer_poll_done(ts));
+	/* 
+	 * The first init ACMD41 starts the card's power up, which should take at most 1 second
+	 * from then. Whether it has finished is left to be polled.
+	 */
+	poll_out->args = args;
+	poll_out->timeout_ts = timer_poll_start(1000);
+	error = sd_issue_acmd(ACMD_IDX_SD_SEND_OP_COND, args, rca);
+	poll_out->next_ts = timer_poll_start(ACMD41_POLL_INTERVAL_MS);
+	return error;
+}
+
+enum cmd_error sd_poll_acmd41(struct acmd41_poll *poll, bool *powered_up_out, 
+			      bool *card_capacity_support_out, bool *accept_1v8_out)
+{
+	enum cmd_error error;
+	uint32_t ocr;
+	bool timed_out;
+
+	*powered_up_out = false;
+	if (!timer_poll_done(poll->next_ts))
+		return CMD_ERROR_NONE;
+	/* Check for the timeout before asking so the card still gets a last chance after it. */
+	timed_out = timer_poll_done(poll->timeout_ts);
+	error = sd_issue_acmd(ACMD_IDX_SD_SEND_OP_COND, poll->args, 0);
+	if (error != CMD_ERROR_NONE)
+		return error;
+	ocr = register_get(&sd_access, RESP0);
 
 	if (ocr&OCR_CARD_POWER_UP_STATUS) {
+		*powered_up_out = true;
 		*card_capacity_support_out = ocr&OCR_CARD_CAPACITY_STATUS;
+		/* The card only sets S18A when the host requested it and it's supported. */
+		*accept_1v8_out = ocr&OCR_S18A;
 		return CMD_ERROR_NONE;
 	}
-	serial_log("SD cmd error: app cmd 41: timeout waiting for card to power up");
-	return CMD_ERROR_GENERAL_TIMEOUT;
+	if (timed_out) {
+		serial_log("SD cmd error: app cmd 41: timeout waiting for card to power up");
+		return CMD_ERROR_GENERAL_TIMEOUT;
+	}
+	poll->next_ts = timer_poll_start(ACMD41_POLL_INTERVAL_MS);
+	return CMD_ERROR_NONE;
+}
+
+enum cmd_error sd_wait_acmd41(struct acmd41_poll *poll, bool *card_capacity_support_out, 
+			      bool *accept_1v8_out)
+{
+	enum cmd_error error;
+	bool powered_up;
+
+	do {
+		sleep(ACMD41_POLL_INTERVAL_MS);
+		error = sd_poll_acmd41(poll, &powered_up, card_capacity_support_out, 
+				       accept_1v8_out);
+	} while (error == CMD_ERROR_NONE && !powered_up);
+	return error;
+}
+
+enum cmd_error sd_issue_acmd41(bool request_1v8, bool *card_capacity_support_out, 
+			       bool *accept_1v8_out)
+{
+	struct acmd41_poll poll;
+	enum cmd_error error;
+
+	error = sd_start_acmd41(request_1v8, &poll);
+	if (error != CMD_ERROR_NONE)
+		return error;
+	return sd_wait_acmd41(&poll, card_capacity_support_out, accept_1v8_out);
 }
 
 enum cmd_error sd_issue_cmd3(int *rca_out)
@@ -439,6 +619,85 @@ enum cmd_error sd_issue_cmd7(int rca)
 	return sd_issue_cmd(CMD_IDX_SELECT_CARD, cast_bitfields(args, uint32_t));
 }
 
+enum cmd_error sd_issue_cmd7_deselect(void)
+{
+	/* RCA 0 is never a card's RCA, so its args are all 0. */
+	return sd_issue_cmd(CMD_IDX_DESELECT_CARD, 0);
+}
+
+/* 
+ * CSD structure field, the CSD version. The R2 response is stored without its CRC 
+ * in the RESP registers, shifting the CSD down 8 bits, so CSD bits 127:126 are in
+ * RESP3 bits 23:22.
+ */
+#define RESP3_CSD_STRUCTURE        BITS(23, 22)
+#define RESP3_CSD_STRUCTURE_SHIFT  22
+/* CSD version 1.0 is used by SDSC cards, and version 2.0 by SDHC/SDXC cards. */
+#define CSD_STRUCTURE_VER_1V0      0
+#define CSD_STRUCTURE_VER_2V0      1
+/* 
+ * CSD version 1.0 capacity fields, at their CSD bit positions less 8: C_SIZE (CSD bits
+ * 73:62) straddles RESP2 and RESP1, C_SIZE_MULT is CSD bits 49:47, and READ_BL_LEN 
+ * CSD bits 83:80. 
+ */
+#define RESP2_CSD1_C_SIZE_HI       BITS(1, 0)
+#define RESP1_CSD1_C_SIZE_LO_SHIFT 22
+#define RESP1_CSD1_C_SIZE_MULT     BITS(9, 7)
+#define RESP1_CSD1_C_SIZE_MULT_SHIFT 7
+#define RESP2_CSD1_READ_BL_LEN     BITS(11, 8)
+#define RESP2_CSD1_READ_BL_LEN_SHIFT 8
+/* CSD version 2.0 C_SIZE, CSD bits 69:48, counting 512 KiB units less one. */
+#define RESP1_CSD2_C_SIZE          BITS(29, 8)
+#define RESP1_CSD2_C_SIZE_SHIFT    8
+#define CSD2_C_SIZE_UNIT_NBLKS     1024
+#define CSD2_C_SIZE_MAX            0x3fffff
+
+/** @brief Get the card's capacity in blocks from the CSD in the RESP registers. */
+static uint32_t csd_nblks(int csd_structure)
+{
+	uint32_t resp1 = register_get(&sd_access, RESP1);
+	uint32_t resp2 = register_get(&sd_access, RESP2);
+	uint32_t c_size, c_size_mult, read_bl_len;
+
+	if (csd_structure == CSD_STRUCTURE_VER_2V0) {
+		c_size = (resp1&RESP1_CSD2_C_SIZE)>>RESP1_CSD2_C_SIZE_SHIFT;
+		/* The largest capacity is one block more than fits, which LBAs can't reach anyway. */
+		if (c_size == CSD2_C_SIZE_MAX)
+			return UINT32_MAX;
+		return (c_size+1)*CSD2_C_SIZE_UNIT_NBLKS;
+	}
+	/* Capacity in bytes is (C_SIZE+1) * 2^(C_SIZE_MULT+2) * 2^READ_BL_LEN. */
+	c_size = (resp2&RESP2_CSD1_C_SIZE_HI)<<(32-RESP1_CSD1_C_SIZE_LO_SHIFT) | 
+		 resp1>>RESP1_CSD1_C_SIZE_LO_SHIFT;
+	c_size_mult = (resp1&RESP1_CSD1_C_SIZE_MULT)>>RESP1_CSD1_C_SIZE_MULT_SHIFT;
+	read_bl_len = (resp2&RESP2_CSD1_READ_BL_LEN)>>RESP2_CSD1_READ_BL_LEN_SHIFT;
+	/* READ_BL_LEN is at least 9, a 512 byte block. */
+	return (c_size+1) << (c_size_mult+2+read_bl_len-9);
+}
+
+enum cmd_error sd_issue_cmd9(int rca, bool *sdhc_or_sdxc_out, uint32_t *nblks_out)
+{
+	struct ac_rca_args args;
+	enum cmd_error error;
+	int csd_structure;
+
+	mzero(&args, sizeof(args));
+	args.rca = rca;
+
+	error = sd_issue_cmd(CMD_IDX_SEND_CSD, cast_bitfields(args, uint32_t));
+	if (error != CMD_ERROR_NONE)
+		return error;
+	csd_structure = (register_get(&sd_access, RESP3)&RESP3_CSD_STRUCTURE)
+			>>RESP3_CSD_STRUCTURE_SHIFT;
+	if (csd_structure != CSD_STRUCTURE_VER_1V0 && csd_structure != CSD_STRUCTURE_VER_2V0) {
+		serial_log("SD cmd error: cmd 9: unknown CSD structure version %u", csd_structure);
+		return CMD_ERROR_RESPONSE_CONTENTS;
+	}
+	*sdhc_or_sdxc_out = csd_structure == CSD_STRUCTURE_VER_2V0;
+	*nblks_out = csd_nblks(csd_structure);
+	return CMD_ERROR_NONE;
+}
+
 enum cmd_error sd_issue_cmd13(int rca, struct card_status *cs_out)
 {
 	struct ac_rca_args args;
@@ -480,9 +739,255 @@ static void set_blkszcnt(int blksz, int blkcnt)
 	register_set(&sd_access, BLKSIZECNT, cast_bitfields(blkszcnt, uint32_t));
 }
 
-enum cmd_error sd_issue_read_cmd(enum cmd_index idx, byte_t *ram_dest_addr, void *sd_src_addr, int nblks)
+/*
+ * How long to wait for a DMA read to complete. Unlike the per block wait when reading 
+ * through the DATA register, the whole read is waited on at once, so the timeout is 
+ * scaled by its size. This allows for transfer rates as low as 1 MB/s, i.e. 2 blocks 
+ * per millisecond.
+ */
+#define dma_read_timeout_ms(nblks) (IRPT_TIMEOUT_MS + (nblks)/2)
+
+enum cmd_error sd_issue_cmd12(void)
+{
+	enum cmd_error error;
+
+	error = sd_issue_cmd(CMD_IDX_STOP_TRANSMISSION, 0);
+	if (error != CMD_ERROR_NONE)
+		return error;
+	/* The transfer complete of an R1b command is triggered when the card stops being busy. */
+	return sd_wait_for_interrupt(INTERRUPT_TRANSFER_COMPLETE);
+}
+
+static int failed_read_nblks_done;
+
+int sd_failed_read_nblks_done(void)
+{
+	return failed_read_nblks_done;
+}
+
+/**
+ * Get how many blocks at the start of a read that failed part way through were read
+ * into RAM, from how far the block count had counted down. 
+ */
+static int sd_read_nblks_done(int nblks)
+{
+	struct cmdtm cmdtm;
+	struct blksizecnt blkszcnt;
+
+	register_get_out(&sd_access, CMDTM, &cmdtm);
+	/* Without the block count there's no knowing, so assume none were read. */
+	if (!cmdtm.block_cnt_en || cmdtm.cmd_index != CMD_IDX_READ_MULTIPLE_BLOCK)
+		return 0;
+	register_get_out(&sd_access, BLKSIZECNT, &blkszcnt);
+	/* The block counted last may still be in the host buffer, so don't count it. */
+	return max(0, nblks-(int)blkszcnt.blkcnt-1);
+}
+
+static bool sd_line_reset_in_progress(void)
+{
+	return register_get(&sd_access, CONTROL1)&(CONTROL1_SW_RESET_CMD|CONTROL1_SW_RESET_DATA);
+}
+
+/** @brief Reset the host's CMD and DAT line state machines after an error. */
+static void sd_reset_cmd_dat_lines(void)
+{
+	register_enable_bits(&sd_access, CONTROL1, CONTROL1_SW_RESET_CMD|CONTROL1_SW_RESET_DATA);
+	while_cond_timeout_infinite(sd_line_reset_in_progress, 20);
+}
+
+/**
+ * Abort a read that failed, leaving the host ready to issue commands again and 
+ * the card back in the transfer state, following the error recovery sequence
+ * in the SD Host Controller spec.
+ */
+static void sd_abort_read(enum cmd_index idx)
+{
+	sd_reset_cmd_dat_lines();
+	/* 
+	 * The card might still be sending blocks. If it has already stopped CMD12 is
+	 * an illegal command, so its error is ignored.
+	 */
+	if (idx == CMD_IDX_READ_MULTIPLE_BLOCK) {
+		sd_issue_cmd12();
+		sd_reset_cmd_dat_lines();
+	}
+}
+
+/**
+ * Stop a read which either failed part way through, so that the card doesn't carry on
+ * sending blocks, or which was open-ended. 
+ *
+ * @param error The read's error, which if set takes precedence over an error stopping it
+ * @return The read's error if set, otherwise the error stopping it.
+ */
+static enum cmd_error sd_stop_read(enum cmd_index idx, int nblks, enum cmd_error error)
 {
+	enum cmd_error_kind error_kind = last_error_kind;
+
+	if (error != CMD_ERROR_NONE) {
+		failed_read_nblks_done = sd_read_nblks_done(nblks);
+		sd_abort_read(idx);
+		/* Keep what caused the read to fail rather than what happened aborting it. */
+		last_error_kind = error_kind;
+		return error;
+	}
+	if (idx != CMD_IDX_READ_MULTIPLE_BLOCK)
+		return error;
+	return sd_issue_cmd12();
+}
+
+/**
+ * Set the auto command for a read. An auto CMD23 takes its block count argument 
+ * from ARG2, and is sent by the host controller straight before the read command 
+ * without the command complete round trip of issuing CMD23 separately.
+ */
+static void set_auto_cmd(enum auto_cmd auto_cmd, int nblks, struct transfer_opts *opts)
+{
+	opts->auto_cmd = auto_cmd;
+	if (auto_cmd == AUTO_CMD_CMD23)
+		register_set(&sd_access, ARG2, nblks);
+}
+
+/**
+ * @brief Stage of a read submitted with sd_submit_read_cmd(), which is moved on 
+ *	  by sd_poll_read_cmd().
+ */
+enum read_state {
+	READ_STATE_IDLE,     /**< No read in flight */
+	READ_STATE_TRANSFER  /**< Host controller copying the read blocks into RAM */
+};
+
+/**
+ * @brief The one read which can be in flight at a time.
+ *
+ * @var submitted_read::stop
+ * Whether to stop the read with CMD12 once all of its blocks are transferred.
+ *
+ * @var submitted_read::ts
+ * When to time out waiting for the transfer to complete.
+ *
+ * @var submitted_read::error
+ * Error of the read, once it's no longer in flight.
+ */
+static struct submitted_read {
+	enum read_state state;
+	enum cmd_index idx;
+	byte_t *ram_dest_addr;
+	int nblks;
+	bool stop;
+	timestamp_t ts;
+	enum cmd_error error;
+} submitted_read;
+
+/**
+ * @brief Start a read with ADMA2, where the host controller copies the read
+ *	  data into RAM without the CPU touching it. Returns once the read 
+ *	  command has been issued, leaving the data transfer in flight.
+ */
+static enum cmd_error sd_submit_read_cmd_dma(enum cmd_index idx, byte_t *ram_dest_addr, 
+					     void *sd_src_addr, int nblks, enum auto_cmd auto_cmd)
+{
+	struct transfer_opts opts;
 	enum cmd_error error;
+
+	/* 
+	 * Reset before any command is issued, so that a read failing before its own
+	 * read command, e.g. on the CMD23 below, isn't retried past blocks counted
+	 * as done by an earlier failed read.
+	 */
+	failed_read_nblks_done = 0;
+	mzero(&opts, sizeof(opts));
+	opts.dma = true;
+	/* 
+	 * The BLKSIZECNT block count field is only 16 bits wide. A read of more blocks
+	 * than fits in it is instead stopped by the end of the descriptor table (and
+	 * the card is told when to stop by CMD23).
+	 */
+	opts.infinite = nblks > UINT16_MAX;
+
+	if (opts.infinite && auto_cmd == AUTO_CMD_CMD23) {
+		/* 
+		 * The host controller expects the block count to be enabled for an auto 
+		 * CMD23, which it can't be here, so issue CMD23 separately.
+		 */
+		error = sd_issue_cmd(CMD_IDX_SET_BLOCK_COUNT, nblks);
+		if (error != CMD_ERROR_NONE)
+			return error;
+	} else if (!opts.infinite) {
+		/* 
+		 * An auto CMD12 is issued when the block count reaches zero, so without
+		 * the block count an open-ended read is stopped with CMD12 below instead.
+		 */
+		set_auto_cmd(auto_cmd, nblks, &opts);
+	}
+	adma2_set_table(ram_dest_addr, nblks*SD_BLKSZ);
+	set_blkszcnt(SD_BLKSZ, opts.infinite ? 0 : nblks);
+
+	error = _sd_issue_cmd(idx, (uint32_t)sd_src_addr, &opts);
+	if (error != CMD_ERROR_NONE)
+		return sd_stop_read(idx, nblks, error);
+
+	submitted_read.state = READ_STATE_TRANSFER;
+	submitted_read.idx = idx;
+	submitted_read.ram_dest_addr = ram_dest_addr;
+	submitted_read.nblks = nblks;
+	submitted_read.stop = opts.infinite && auto_cmd == AUTO_CMD_CMD12;
+	submitted_read.ts = timer_poll_start(dma_read_timeout_ms(nblks));
+	submitted_read.error = CMD_ERROR_NONE;
+	return CMD_ERROR_NONE;
+}
+
+bool sd_poll_read_cmd(void)
+{
+	struct interrupt irpt;
+	enum cmd_error error;
+
+	if (submitted_read.state == READ_STATE_IDLE)
+		return false;
+
+	irpt = sd_get_any_interrupt(INTERRUPT_TRANSFER_COMPLETE);
+	if (cast_bitfields(irpt, uint32_t)) {
+		error = sd_check_interrupt(irpt);
+	} else if (timer_poll_done(submitted_read.ts)) {
+		serial_log("SD cmd error: timeout waiting for read transfer to complete");
+		last_error_kind = CMD_ERROR_KIND_TIMEOUT;
+		error = CMD_ERROR_WAIT_FOR_INTERRUPT_TIMEOUT;
+	} else {
+		return true;
+	}
+	if (error != CMD_ERROR_NONE || submitted_read.stop)
+		error = sd_stop_read(submitted_read.idx, submitted_read.nblks, error);
+	/* Drop any lines speculatively cached from the destination while it was being written. */
+	dcache_invalidate_range(submitted_read.ram_dest_addr, submitted_read.nblks*SD_BLKSZ);
+
+	submitted_read.error = error;
+	submitted_read.state = READ_STATE_IDLE;
+	return false;
+}
+
+enum cmd_error sd_wait_read_cmd(void)
+{
+	enum cmd_error error;
+
+	while (sd_poll_read_cmd()) {
+		log_drain();
+		usleep(50);
+	}
+	error = submitted_read.error;
+	submitted_read.error = CMD_ERROR_NONE;
+	return error;
+}
+
+/**
+ * @brief Read blocks by copying them out of the DATA register, for when
+ *	  the host controller doesn't support ADMA2.
+ */
+static enum cmd_error sd_issue_read_cmd_pio(enum cmd_index idx, byte_t *ram_dest_addr, 
+					    void *sd_src_addr, int nblks, enum auto_cmd auto_cmd)
+{
+	struct transfer_opts opts;
+	enum cmd_error error;
+	int nblks_left = nblks;
 	/* 
 	 * Address of the SD DATA register in RAM. Peripheral access functions 
 	 * such as register_get() are avoided for performance reasons.
@@ -491,11 +996,15 @@ enum cmd_error sd_issue_read_cmd(enum cmd_index idx, byte_t *ram_dest_addr, void
 					  + sd_access.periph_base_off
 					  + sd_access.register_offsets[DATA]);
 
+	/* Reset before any command is issued, as in sd_submit_read_cmd_dma(). */
+	failed_read_nblks_done = 0;
+	mzero(&opts, sizeof(opts));
+	set_auto_cmd(auto_cmd, nblks, &opts);
 	set_blkszcnt(SD_BLKSZ, nblks);
 
-	error = sd_issue_cmd(idx, (uint32_t)sd_src_addr);
+	error = _sd_issue_cmd(idx, (uint32_t)sd_src_addr, &opts);
 	if (error != CMD_ERROR_NONE)
-		return error;
+		return sd_stop_read(idx, nblks, error);
 	/*
 	 * Parts of this function are written in assembly for the performance 
 	 * improvement. Here the non-scratch registers starting at r4 and 
@@ -507,7 +1016,7 @@ enum cmd_error sd_issue_read_cmd(enum cmd_index idx, byte_t *ram_dest_addr, void
 		: 
 		: "r" (sd_data_addr), "r" (ram_dest_addr));
 
-	while (nblks--) {
+	while (nblks_left--) {
 		error = sd_wait_for_interrupt(INTERRUPT_READ_READY);
 		if (error != CMD_ERROR_NONE) 
 			goto sd_issue_read_cmd_cleanup;
@@ -527,17 +1036,100 @@ enum cmd_error sd_issue_read_cmd(enum cmd_index idx, byte_t *ram_dest_addr, void
 	error = sd_wait_for_interrupt(INTERRUPT_TRANSFER_COMPLETE);
 sd_issue_read_cmd_cleanup:
 	__asm__("pop {r4-r7}");
+	if (error != CMD_ERROR_NONE)
+		error = sd_stop_read(idx, nblks, error);
 	return error;
 }
 
-enum cmd_error sd_issue_cmd17(byte_t *ram_dest_addr, void *sd_src_addr)
+enum cmd_error sd_submit_read_cmd(byte_t *ram_dest_addr, void *sd_src_addr, int nblks, 
+				  enum auto_cmd auto_cmd)
+{
+	enum cmd_index idx = nblks == 1 ? CMD_IDX_READ_SINGLE_BLOCK : CMD_IDX_READ_MULTIPLE_BLOCK;
+
+	if (nblks == 1)
+		auto_cmd = AUTO_CMD_NONE;
+	if (adma2_selected())
+		return sd_submit_read_cmd_dma(idx, ram_dest_addr, sd_src_addr, nblks, auto_cmd);
+	/* The CPU does the whole transfer itself, so it's finished by the time this returns. */
+	return sd_issue_read_cmd_pio(idx, ram_dest_addr, sd_src_addr, nblks, auto_cmd);
+}
+
+enum cmd_error sd_issue_read_cmd(byte_t *ram_dest_addr, void *sd_src_addr, int nblks, 
+				 enum auto_cmd auto_cmd)
+{
+	enum cmd_error error = sd_submit_read_cmd(ram_dest_addr, sd_src_addr, nblks, auto_cmd);
+
+	if (error != CMD_ERROR_NONE)
+		return error;
+	return sd_wait_read_cmd();
+}
+
+/* Size in bytes of the switch function status data block sent by CMD6. */
+#define SWITCH_STATUS_SZ 64
+/* 
+ * Byte offsets into the switch function status data block. The status is sent most
+ * significant bit first, so byte 0 holds bits 511:504 of the status.
+ */
+#define SWITCH_STATUS_GROUP1_SUPPORT_OFF    12  /* Bits 415:400. */
+#define SWITCH_STATUS_GROUP1_SELECTION_OFF  16  /* Bits 379:376 in the low nibble. */
+
+enum cmd_error sd_issue_cmd6(bool mode_switch, int group1_function, struct switch_status *status_out)
 {
-	return sd_issue_read_cmd(CMD_IDX_READ_SINGLE_BLOCK, ram_dest_addr, sd_src_addr, 1);
+	struct {
+		bits_t group1 : 4;
+		/* Function groups 2 to 6 are set to 0xf to leave them unchanged. */
+		bits_t groups2_to_6 : 20;
+		bits_t reserved : 7;
+		bits_t mode_switch : 1;
+	} __attribute__((packed)) args;
+	uint32_t status[SWITCH_STATUS_SZ/sizeof(uint32_t)];
+	uint8_t *bytes = (uint8_t *)status;
+	enum cmd_error error;
+
+	mzero(&args, sizeof(args));
+	args.group1 = group1_function;
+	args.groups2_to_6 = 0xfffff;
+	args.mode_switch = mode_switch;
+
+	set_blkszcnt(SWITCH_STATUS_SZ, 1);
+
+	error = sd_issue_cmd(CMD_IDX_SWITCH_FUNC, cast_bitfields(args, uint32_t));
+	if (error != CMD_ERROR_NONE) 
+		return error;
+	error = sd_wait_for_interrupt(INTERRUPT_READ_READY);
+	if (error != CMD_ERROR_NONE) 
+		return error;
+	/* 
+	 * Each word read has the earliest received byte in its least significant
+	 * byte, so storing the words as is keeps the bytes in the order received.
+	 */
+	for (int i = 0; i < array_len(status); ++i)
+		status[i] = register_get(&sd_access, DATA);
+
+	status_out->group1_support = bytes[SWITCH_STATUS_GROUP1_SUPPORT_OFF]<<8 
+				     | bytes[SWITCH_STATUS_GROUP1_SUPPORT_OFF+1];
+	status_out->group1_selection = bytes[SWITCH_STATUS_GROUP1_SELECTION_OFF]&0xf;
+
+	return sd_wait_for_interrupt(INTERRUPT_TRANSFER_COMPLETE);
 }
 
-enum cmd_error sd_issue_cmd18(byte_t *ram_dest_addr, void *sd_src_addr, int nblks)
+/* Size in bytes of the tuning block sent by CMD19 on a 4-bit data bus. */
+#define TUNING_BLOCK_SZ 64
+
+enum cmd_error sd_issue_cmd19(void)
 {
-	return sd_issue_read_cmd(CMD_IDX_READ_MULTIPLE_BLOCK, ram_dest_addr, sd_src_addr, nblks);
+	enum cmd_error error;
+
+	set_blkszcnt(TUNING_BLOCK_SZ, 1);
+
+	error = sd_issue_cmd(CMD_IDX_SEND_TUNING_BLOCK, 0);
+	if (error != CMD_ERROR_NONE)
+		return error;
+	/* 
+	 * While tuning the host controller checks the tuning block against the
+	 * known tuning pattern itself, so it doesn't need reading out of DATA.
+	 */
+	return sd_wait_for_interrupt(INTERRUPT_READ_READY);
 }
 
 enum cmd_error sd_issue_acmd51(int rca, struct scr *scr_out)
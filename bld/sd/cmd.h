@@ -7,9 +7,15 @@
 
 #include "../type.h"
 #include "../bits.h"
+#include "../timer.h"
 
 /** @brief A cmd_index has this bit set if it's an application command. */
 #define IS_APP_CMD 0x80
+/** 
+ * @brief A cmd_index has this bit set if it's a variant of the command with the same
+ *	  index, used in a way that changes its type or response.
+ */
+#define IS_VARIANT_CMD 0x40
 
 /**
  * @brief Index identifier for a command. 
@@ -18,13 +24,20 @@ enum cmd_index {
 	CMD_IDX_GO_IDLE_STATE       = 0,
 	CMD_IDX_ALL_SEND_CID        = 2,
 	CMD_IDX_SEND_RELATIVE_ADDR  = 3,
+	CMD_IDX_SWITCH_FUNC         = 6,
 	CMD_IDX_SELECT_CARD         = 7,
 	CMD_IDX_SEND_IF_COND        = 8,  /**< Send interface condition. */
+	CMD_IDX_SEND_CSD            = 9,  /**< Send card specific data register. */
+	CMD_IDX_VOLTAGE_SWITCH      = 11, /**< Switch to 1.8V signalling. */
+	CMD_IDX_STOP_TRANSMISSION   = 12,
 	CMD_IDX_SEND_STATUS         = 13,
 	CMD_IDX_READ_SINGLE_BLOCK   = 17,
 	CMD_IDX_READ_MULTIPLE_BLOCK = 18,
+	CMD_IDX_SEND_TUNING_BLOCK   = 19,
 	CMD_IDX_SET_BLOCK_COUNT     = 23,
 	CMD_IDX_APP_CMD             = 55,
+/* Command variants. */
+	CMD_IDX_DESELECT_CARD       = 7|IS_VARIANT_CMD,  /**< CMD7 with RCA 0, which isn't responded to. */
 /* Application commands. */
 	ACMD_IDX_SET_BUS_WIDTH      = 6|IS_APP_CMD,
 	ACMD_IDX_SD_SEND_OP_COND    = 41|IS_APP_CMD, /**< Send operating condition register. */
@@ -59,6 +72,22 @@ enum cmd_error {
 	CMD_ERROR_GENERAL_TIMEOUT
 };
 
+/**
+ * @brief What went wrong on the bus to cause a command or transfer to fail, 
+ *	  used to decide whether it's worth retrying.
+ */
+enum cmd_error_kind {
+	CMD_ERROR_KIND_OTHER,   /**< Not a bus error, e.g. a card status error, so not retried */
+	CMD_ERROR_KIND_CRC,     /**< CRC, end bit, or index error: data corrupted on the bus */
+	CMD_ERROR_KIND_TIMEOUT  /**< Card didn't respond or send data in time */
+};
+
+/**
+ * @brief Get the kind of error which caused the last failed command or transfer.
+ *	  Only valid straight after a failure.
+ */
+enum cmd_error_kind sd_last_error_kind(void);
+
 /**
  * Issue a command to the SD card. If the return is successful (CMD_ERROR_NONE)
  * and the command expects a response, check the RESP* registers for the response.
@@ -87,13 +116,53 @@ enum cmd_error sd_issue_cmd8(void);
 /**
  * @brief Power up the card.
  *
+ * @param request_1v8 Whether to request that the card switches to 1.8V signalling
  * @param[out] card_capacity_support_out Card capacity support, whether card is SDHC/SDXC (true) or SDSC (false).
  *					 Only valid on success.
+ * @param[out] accept_1v8_out Whether the card accepted the request to switch to 1.8V signalling,
+ *			      which must then be followed by CMD11. Only valid on success.
  *
  * @return CMD_ERROR_RESPONSE_CONTENTS voltage range not supported in card's OCR register
  * @return CMD_ERROR_GENERAL_TIMEOUT if the card did not power up in 1 second
  */
-enum cmd_error sd_issue_acmd41(bool *card_capacity_support_out);
+enum cmd_error sd_issue_acmd41(bool request_1v8, bool *card_capacity_support_out, 
+			       bool *accept_1v8_out);
+
+/**
+ * @brief A card power up started with sd_start_acmd41() that hasn't finished yet.
+ */
+struct acmd41_poll {
+	uint32_t args;  /**< Argument to the init ACMD41 */
+	timestamp_t timeout_ts;  /**< When the card should have powered up by */
+	timestamp_t next_ts;  /**< When to next check whether the card has powered up */
+};
+
+/**
+ * @brief Start powering up the card as in sd_issue_acmd41() without waiting for it to
+ *	  finish, which it's then polled for with sd_poll_acmd41().
+ *
+ * @param[out] poll_out State to pass to sd_poll_acmd41()
+ *
+ * @return CMD_ERROR_RESPONSE_CONTENTS voltage range not supported in card's OCR register
+ */
+enum cmd_error sd_start_acmd41(bool request_1v8, struct acmd41_poll *poll_out);
+/**
+ * @brief Check whether the card power up started with sd_start_acmd41() has finished, 
+ *	  without waiting on it. The card is asked again at most every 20 milliseconds.
+ *
+ * @param[out] powered_up_out Whether the card has finished powering up. The other out 
+ *			      parameters are only valid when this is set on success.
+ *
+ * @return CMD_ERROR_GENERAL_TIMEOUT if the card did not power up in 1 second
+ */
+enum cmd_error sd_poll_acmd41(struct acmd41_poll *poll, bool *powered_up_out, 
+			      bool *card_capacity_support_out, bool *accept_1v8_out);
+/**
+ * @brief Wait for the card power up started with sd_start_acmd41() to finish. 
+ *	  Parameters and return are as in sd_issue_acmd41().
+ */
+enum cmd_error sd_wait_acmd41(struct acmd41_poll *poll, bool *card_capacity_support_out, 
+			      bool *accept_1v8_out);
 
 /**
  * @brief Publish a new relative card address for the card in out-param rca_out.
@@ -109,6 +178,20 @@ enum cmd_error sd_issue_cmd3(int *rca_out);
  * To get the state that was toggled to, issue CMD13 after this.
  */
 enum cmd_error sd_issue_cmd7(int rca);
+/**
+ * @brief Deselect whichever card is selected, toggling it from the transfer state to 
+ *	  the standby state. Cards not selected are unaffected.
+ */
+enum cmd_error sd_issue_cmd7_deselect(void);
+
+/**
+ * @brief Get the capacity of the addressed card from its card specific data register. 
+ *	  Can only be issued in the standby state.
+ *
+ * @param[out] sdhc_or_sdxc_out Whether the card is SDHC/SDXC (true) or SDSC (false).
+ * @param[out] nblks_out Capacity of the card in SD_BLKSZ blocks.
+ */
+enum cmd_error sd_issue_cmd9(int rca, bool *sdhc_or_sdxc_out, uint32_t *nblks_out);
 
 /**
  * @brief Card status response from RESPONSE_R1_NORMAL and RESPONSE_R1B_NORMAL_BUSY. 
@@ -153,17 +236,98 @@ enum cmd_error sd_issue_cmd13(int rca, struct card_status *cs_out);
 enum cmd_error sd_issue_acmd6(int rca, bool four_bit);
 
 /**
- * @brief Read a single block (CMD17) or multiple blocks (CMD18) of size SD_BLKSZ 
- *	  from the SD card into RAM.
+ * @brief Switch function status returned by CMD6, reduced to the fields
+ *	  of function group 1 (access mode, which selects the bus speed mode).
+ *
+ * @var switch_status::group1_support
+ * Bit n is set if function n of function group 1 is supported by the card.
+ *
+ * @var switch_status::group1_selection
+ * The function of function group 1 that the card is switched to (or would be, 
+ * if only checking), or 0xf if the function can't be switched to.
+ */
+struct switch_status {
+	uint16_t group1_support;
+	int group1_selection;
+};
+
+/**
+ * @brief Check (mode_switch false) whether the card can switch function group 1 
+ *	  to a function, or switch it (mode_switch true). The other function groups 
+ *	  are left unchanged.
+ *
+ * Can only be issued in the transfer state.
+ */
+enum cmd_error sd_issue_cmd6(bool mode_switch, int group1_function, struct switch_status *status_out);
+
+/**
+ * @brief Command issued automatically by the host controller as part of a multiple 
+ *	  block transfer, saving issuing it separately. The value of each is the value 
+ *	  of the cmdtm auto command enable field for it.
+ */
+enum auto_cmd {
+	AUTO_CMD_NONE  = 0b00,
+	AUTO_CMD_CMD12 = 0b01,  /**< Stop the transfer with CMD12 after the last block */
+	AUTO_CMD_CMD23 = 0b10   /**< Set the block count with CMD23 before the transfer */
+};
+
+/**
+ * @brief Read a single block (CMD17 if nblks is 1) or multiple blocks (CMD18) of size 
+ *	  SD_BLKSZ from the SD card into RAM.
  *
  * @param ram_dest_addr 4-byte aligned destination address in RAM to copy read data to
  * @param sd_src_addr Source SD card address to read data from. If the card is SDSC this 
  *		      should be a byte unit address. If the card is SDHC or SDXC this should 
  *		      be a block unit address (LBA).
  * @param nblks Number of blocks to read
+ * @param auto_cmd Command for the host controller to issue as part of a multiple block 
+ *		   transfer. AUTO_CMD_CMD23 requires the card support CMD23.
+ */
+enum cmd_error sd_issue_read_cmd(byte_t *ram_dest_addr, void *sd_src_addr, int nblks, 
+				 enum auto_cmd auto_cmd);
+
+/**
+ * @brief Start a read as in sd_issue_read_cmd() without waiting for its data to finish 
+ *	  transferring, so that the CPU can do other work while the read is in flight. 
+ *	  No other command can be issued until the read is waited on with sd_wait_read_cmd().
+ *
+ * Only an ADMA2 read is left in flight: a read through the DATA register has the CPU
+ * copy all of its data before this returns.
+ *
+ * @return Error issuing the read command. Errors transferring the data are returned
+ *	   by sd_wait_read_cmd().
+ */
+enum cmd_error sd_submit_read_cmd(byte_t *ram_dest_addr, void *sd_src_addr, int nblks, 
+				  enum auto_cmd auto_cmd);
+/**
+ * @brief Check on the read submitted with sd_submit_read_cmd() without blocking, 
+ *	  finishing it if its transfer is complete.
+ * @return Whether the read is still in flight.
+ */
+bool sd_poll_read_cmd(void);
+/**
+ * @brief Wait for the read submitted with sd_submit_read_cmd() to finish.
+ * @return Error transferring the read's data, or CMD_ERROR_NONE if no read was submitted.
+ */
+enum cmd_error sd_wait_read_cmd(void);
+/**
+ * @brief Get how many blocks at the start of the last failed read were read into RAM 
+ *	  before it failed, so that a retry only needs to read the rest. Only valid 
+ *	  straight after a failure.
+ */
+int sd_failed_read_nblks_done(void);
+
+/**
+ * @brief Stop a multiple block transfer, waiting for the card to stop being busy.
+ *	  Can be issued while the DAT line is still in use by the transfer.
+ */
+enum cmd_error sd_issue_cmd12(void);
+
+/**
+ * @brief Send a tuning block to the host, for one iteration of the host's sampling 
+ *	  clock tuning procedure. Requires the host to be executing tuning. 
  */
-enum cmd_error sd_issue_cmd17(byte_t *ram_dest_addr, void *sd_src_addr);
-enum cmd_error sd_issue_cmd18(byte_t *ram_dest_addr, void *sd_src_addr, int nblks);
+enum cmd_error sd_issue_cmd19(void);
 
 /** @brief SD card configuration register. */
 struct scr {
@@ -171,10 +335,14 @@ struct scr {
 	bits_t cmd23_supported : 1; 
 	bits_t ignore2 : 14;
 	bits_t bus_widths : 4;
-	bits_t ignore3 : 12;
+	bits_t ignore3 : 4;
+	bits_t sd_spec : 4;  /**< Physical layer spec version (see SCR_SD_SPEC_*) */
+	bits_t ignore4 : 4;
 } __attribute__((packed));
 
 #define SCR_BUS_WIDTHS_4BIT BIT(2)
+/* Version 1.10, the first version with CMD6. */
+#define SCR_SD_SPEC_1V10    1
 
 /** @brief Get the SD card to send its SCR register. */
 enum cmd_error sd_issue_acmd51(int rca, struct scr *scr_out);
@@ -11,10 +11,14 @@
 #include "../bits.h"
 
 enum sd_register {
+	ARG2,
 	BLKSIZECNT,
 	ARG1,
 	CMDTM,
 	RESP0,
+	RESP1,
+	RESP2,
+	RESP3,
 	DATA,
 	STATUS,
 	CONTROL0,
@@ -22,7 +26,13 @@ enum sd_register {
 	INTERRUPT,
 	IRPT_MASK,
 	IRPT_EN,
-	FORCE_IRPT
+	CONTROL2,
+	CAPABILITIES0,
+	CAPABILITIES1,
+	FORCE_IRPT,
+	ADMA_ERR_STATUS,
+	ADMA_SYS_ADDR,
+	SLOTISR_VER
 };
 
 static struct periph_access sd_access = {
@@ -32,18 +42,28 @@ static struct periph_access sd_access = {
 	 */
 	.periph_base_off = 0x2340000,
 	.register_offsets = {
-		[BLKSIZECNT] = 0x04,
-		[ARG1]       = 0x08,
-		[CMDTM]      = 0x0c,
-		[RESP0]      = 0x10,
-		[DATA]	     = 0x20,
-		[STATUS]     = 0x24,
-		[CONTROL0]   = 0x28,
-		[CONTROL1]   = 0x2c,
-		[INTERRUPT]  = 0x30,
-		[IRPT_MASK]  = 0x34,
-		[IRPT_EN]    = 0x38,
-		[FORCE_IRPT] = 0x50
+		[ARG2]            = 0x00,
+		[BLKSIZECNT]      = 0x04,
+		[ARG1]            = 0x08,
+		[CMDTM]           = 0x0c,
+		[RESP0]           = 0x10,
+		[RESP1]           = 0x14,
+		[RESP2]           = 0x18,
+		[RESP3]           = 0x1c,
+		[DATA]            = 0x20,
+		[STATUS]          = 0x24,
+		[CONTROL0]        = 0x28,
+		[CONTROL1]        = 0x2c,
+		[INTERRUPT]       = 0x30,
+		[IRPT_MASK]       = 0x34,
+		[IRPT_EN]         = 0x38,
+		[CONTROL2]        = 0x3c,
+		[CAPABILITIES0]   = 0x40,
+		[CAPABILITIES1]   = 0x44,
+		[FORCE_IRPT]      = 0x50,
+		[ADMA_ERR_STATUS] = 0x54,
+		[ADMA_SYS_ADDR]   = 0x58,
+		[SLOTISR_VER]     = 0xfc
 	}
 };
 
@@ -54,7 +74,7 @@ struct blksizecnt {
 } __attribute__((packed));
 
 struct cmdtm {
-	bits_t reserved1 : 1;
+	bits_t dma_en : 1;
 	bits_t block_cnt_en : 1;
 	enum {
 		CMDTM_TM_AUTO_CMD_EN_NONE  = 0b00,
@@ -78,7 +98,10 @@ struct cmdtm {
 	bits_t cmd_crc_chk_en : 1;
 	bits_t cmd_index_chk_en : 1;
 	bits_t data_present : 1;
-	bits_t cmd_type : 2;
+	enum {
+		CMDTM_CMD_TYPE_NORMAL = 0b00,
+		CMDTM_CMD_TYPE_ABORT  = 0b11  /* CMD12 stopping a transfer. */
+	} cmd_type : 2;
 	bits_t cmd_index : 6;
 	bits_t reserved4 : 2;
 } __attribute__((packed));
@@ -109,18 +132,31 @@ struct interrupt {
 	bits_t data_end_bit_error : 1;
 	bits_t reserved4 : 1;
 	bits_t auto_cmd_error : 1;
-	bits_t reserved5 : 7;
+	bits_t adma_error : 1;
+	bits_t reserved5 : 6;
 } __attribute__((packed));
 
 /* Extra masks for the interrupt registers (INTERRUPT, etc., as above). */
 #define INTERRUPT_CMD_COMPLETE       BIT(0)
 #define INTERRUPT_TRANSFER_COMPLETE  BIT(1)
 #define INTERRUPT_READ_READY         BIT(5)
+/* The error summary bit and all of the error bits. */
+#define INTERRUPT_ERRORS             BITS(31, 15)
 
 #define STATUS_COMMAND_INHIBIT_CMD  BIT(0)
 #define STATUS_COMMAND_INHIBIT_DAT  BIT(1)
+/* Levels of lines DAT[3:0]. */
+#define STATUS_DAT_LEVEL0           BITS(23, 20)
+#define STATUS_DAT_LEVEL0_SHIFT     20
 
 #define CONTROL0_DATA_TRANSFER_WIDTH  BIT(1)
+#define CONTROL0_HS_EN                BIT(2)  /* High speed enable. */
+/* 
+ * DMA select. Also listed as reserved in the BCM2835 datasheet, but is a
+ * field of the host control 1 register in the SD Host Controller spec.
+ */
+#define CONTROL0_DMA_SEL              BITS(4, 3)
+#define CONTROL0_DMA_SEL_ADMA2_32BIT  (0b10<<3)
 /*
  * The BCM2835 datasheet lists the below power control bits as reserved, 
  * but from the SD Host Controller spec they make up the power control 
@@ -134,8 +170,43 @@ struct interrupt {
 #define CONTROL1_INT_CLK_EN      BIT(0)  /* Internal clock enable. */
 #define CONTROL1_INT_CLK_STABLE  BIT(1)  /* Internal clock stable. */
 #define CONTROL1_CLK_EN          BIT(2)  /* Clock enable. */
+/* Most significant 2 bits of a 10-bit SD clock frequency select. */
+#define CONTROL1_CLK_FREQ_MS2    BITS(7, 6)
+#define CONTROL1_CLK_FREQ_MS2_SHIFT 6
 #define CONTROL1_CLK_FREQ_SEL    BITS(15, 8)  /* SD clock frequency select. */
 #define CONTROL1_CLK_FREQ_SEL_SHIFT 8
 #define CONTROL1_SW_RESET_HC     BIT(24)  /* Software reset host controller. */
+#define CONTROL1_SW_RESET_CMD    BIT(25)  /* Software reset CMD line. */
+#define CONTROL1_SW_RESET_DATA   BIT(26)  /* Software reset DAT line. */
+
+/* Auto CMD error status bits, which say why an auto command error interrupt was triggered. */
+#define CONTROL2_AUTO_CMD_ERRORS BITS(7, 0)
+#define CONTROL2_ACTO_ERR       BIT(1)  /* Auto command timeout. */
+#define CONTROL2_ACCRC_ERR      BIT(2)  /* Auto command CRC error. */
+#define CONTROL2_ACEND_ERR      BIT(3)  /* Auto command end bit error. */
+#define CONTROL2_ACBAD_ERR      BIT(4)  /* Auto command index error. */
+/* UHS mode (bus speed mode) select, only valid with 1.8V signalling enabled. */
+#define CONTROL2_UHSMODE        BITS(18, 16)
+#define CONTROL2_UHSMODE_SHIFT  16
+/* 
+ * 1.8V signalling enable. Listed as reserved in the BCM2835 datasheet, but is a 
+ * field of the host control 2 register in the SD Host Controller spec. 
+ */
+#define CONTROL2_1V8_EN         BIT(19)
+#define CONTROL2_TUNEON         BIT(22)  /* Execute tuning. */
+#define CONTROL2_TUNED          BIT(23)  /* Sample with the tuned clock. */
+
+/* Registers not in the BCM2835 datasheet, from the SD Host Controller spec. */
+#define CAPABILITIES0_ADMA2_SUPPORT  BIT(19)
+
+#define CAPABILITIES1_SDR50_SUPPORT   BIT(0)
+#define CAPABILITIES1_SDR104_SUPPORT  BIT(1)
+#define CAPABILITIES1_DDR50_SUPPORT   BIT(2)
+#define CAPABILITIES1_SDR50_TUNING    BIT(13)  /* Use tuning for SDR50. */
+
+/* Host controller specification version. */
+#define SLOTISR_VER_SDVERSION        BITS(23, 16)
+#define SLOTISR_VER_SDVERSION_SHIFT  16
+#define SDVERSION_3V00               2
 
 #endif
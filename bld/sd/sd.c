@@ -13,11 +13,11 @@
 #include "../help.h"
 #include "reg.h"
 #include "cmd.h"
+#include "adma.h"
 #include "../debug.h"
+#include "../timer.h"
 #include "sd_blksz.h"
 
-/* 100 MHz. */
-#define EMMC2_EXPECTED_BASE_CLOCK_HZ 100000000
 /* 
  * 400 KHz, the clock frequency a card operates in after power-up
  * and during the card identification process.
@@ -25,6 +25,32 @@
 #define IDENTIFICATION_CLOCK_RATE_HZ	400000
 /* 25 MHz. */
 #define DEFAULT_SPEED_CLOCK_RATE_HZ   25000000
+/* 50 MHz. */
+#define HIGH_SPEED_CLOCK_RATE_HZ      50000000
+/* 
+ * UHS-I bus speed mode max clock rates. The base clock is raised for those above
+ * its rate, and if it can't be raised high enough they're capped to the base clock 
+ * rate by the clock divider.
+ */
+#define SDR50_CLOCK_RATE_HZ           100000000
+#define SDR104_CLOCK_RATE_HZ          208000000
+#define DDR50_CLOCK_RATE_HZ           50000000
+/* Max number of CMD19 tuning blocks a host needs to complete tuning. */
+#define TUNING_MAX_BLOCKS             40
+/*
+ * Whether to try reusing the card as the VideoCore firmware left it, already identified
+ * from reading this bootloader off it, before falling back to identifying it. This skips
+ * the card's power up, which can take hundreds of milliseconds, but leaves the card at
+ * 3.3V signalling, since the switch to 1.8V can only be done during identification, so
+ * it gives up the UHS-I bus speed modes. Set by the sd_init variable in the Makefile.
+ */
+#ifndef SD_WARM_INIT
+#define SD_WARM_INIT 0
+#endif
+/* Number of times to retry a read that failed with a bus error before giving up. */
+#define READ_MAX_RETRIES              5
+/* Number of bus errors after which the bus is stepped down to a slower speed or width. */
+#define BUS_ERRORS_BEFORE_STEP_DOWN   2
 
 enum card_state {
 /* Inactive operation mode. */
@@ -43,6 +69,22 @@ enum card_state {
 	CARD_STATE_DISCONNECT
 };
 
+/**
+ * @brief Bus speed mode. The value of each is the function number which 
+ *	  selects the mode in switch function group 1 (access mode), and
+ *	  is also the value of the host control 2 UHS mode select field for
+ *	  the mode. With 1.8V signalling default speed and high speed are 
+ *	  named SDR12 and SDR25.
+ */
+enum bus_mode {
+	BUS_MODE_DEFAULT_SPEED = 0,
+	BUS_MODE_HIGH_SPEED    = 1,
+/* Below are UHS-I modes, which require 1.8V signalling. */
+	BUS_MODE_SDR50         = 2,
+	BUS_MODE_SDR104        = 3,
+	BUS_MODE_DDR50         = 4
+};
+
 /**
  * @brief Card (SD card) metadata and bookkeeping data.
  */
@@ -55,46 +97,85 @@ struct card {
 	bool sdhc_or_sdxc;  
 	int rca;  /**< Card's relative card address */
 	bool cmd23_supported;
+	enum bus_mode bus_mode;
+	bool signalling_1v8;  /**< Whether the bus IO lines signal at 1.8V, otherwise 3.3V */
+	int clock_rate;  /**< Actual rate of the clock supplied to the card, in Hz */
+	bool four_bit_bus;  /**< Whether the data bus width is 4-bit, otherwise 1-bit */
+	int bus_errors;  /**< Number of read bus errors since the bus was last stepped down */
+	uint32_t nblks;  /**< Capacity of the card in blocks */
 };
 
 /**
- * @brief Assert that the EMMC2 base clock has a clock rate of EMMC2_EXPECTED_BASE_CLOCK_HZ.
+ * Rate of the EMMC2 base clock in Hz, as read back from the VideoCore, which the
+ * card's clock is divided down from.
  */
-static void sd_assert_base_clock(void)
-{
-	struct clock_state state;
-	int rate;
+static uint32_t base_clock_rate;
+
+/** Rate of the EMMC2 base clock in Hz at boot, restored on reset for the next stage. */
+static uint32_t orig_base_clock_rate;
 
-	state = tag_clock_get_state(CLK_EMMC2);
-	if (state.clk_not_exists || !state.on) {
+/**
+ * @brief Assert that the EMMC2 base clock is on, and get its rate. 
+ */
+static void sd_assert_base_clock(struct vc_boot_state *vc)
+{
+	if (vc->emmc2_clk.clk_not_exists || !vc->emmc2_clk.on) {
 		serial_log("SD init error: EMMC2 clock either doesn't exist or isn't on");
 		signal_error(ERROR_VC_NOT_INIT_MMC);
 	}
-	rate = tag_clock_get_rate(CLK_EMMC2);
-	if (rate != EMMC2_EXPECTED_BASE_CLOCK_HZ) {
-		serial_log("SD init error: EMMC2 clock rate %u Hz doesn't match expected clock rate %u Hz",
-			   rate, EMMC2_EXPECTED_BASE_CLOCK_HZ);
+	base_clock_rate = vc->emmc2_clk_rate;
+	if (!base_clock_rate) {
+		serial_log("SD init error: EMMC2 clock rate is 0 Hz");
 		signal_error(ERROR_VC_NOT_INIT_MMC);
 	}
+	orig_base_clock_rate = base_clock_rate;
+	serial_log("EMMC2 base clock rate %u Hz", base_clock_rate);
+}
+
+/**
+ * @brief Ask the VideoCore to raise the EMMC2 base clock towards a rate, as far as its
+ *	  max rate allows, and read back the rate it was set to. Must only be called with 
+ *	  the card's clock stopped.
+ */
+static void sd_raise_base_clock(uint32_t target_rate)
+{
+	uint32_t max_rate = tag_clock_get_max_rate(CLK_EMMC2);
+	uint32_t rate = target_rate < max_rate ? target_rate : max_rate;
+
+	if (rate <= base_clock_rate)
+		return;
+	tag_clock_set_rate(CLK_EMMC2, rate);
+	/* The VideoCore can round the rate, so read back what it was actually set to. */
+	base_clock_rate = tag_clock_get_rate(CLK_EMMC2);
+	serial_log("Raised EMMC2 base clock to %u Hz", base_clock_rate);
+}
+
+/**
+ * @brief Put the EMMC2 base clock back to its rate at boot if it was raised. Must only
+ *	  be called with the card's clock stopped.
+ */
+static void sd_restore_base_clock(void)
+{
+	if (base_clock_rate == orig_base_clock_rate)
+		return;
+	tag_clock_set_rate(CLK_EMMC2, orig_base_clock_rate);
+	base_clock_rate = orig_base_clock_rate;
+	serial_log("Restored EMMC2 base clock to %u Hz", base_clock_rate);
 }
 
 /**
  * @brief Assert that the supply for the bus IO line power is 3.3V (the expected voltage
  *	  after a power cycle).
  */
-static void sd_assert_voltage(void)
+static void sd_assert_voltage(struct vc_boot_state *vc)
 {
-	struct gpio_expander_pin_config cfg;
-	int state;
-
-	cfg = tag_gpio_get_config(GPIO_EXPANDER_VDD_SD_IO_SEL);
-	if (!gpio_config_pin_is_output(&cfg) || !gpio_config_pin_is_active_high(&cfg)) {
+	if (!gpio_config_pin_is_output(&vc->sd_io_sel_cfg) || 
+	    !gpio_config_pin_is_active_high(&vc->sd_io_sel_cfg)) {
 		serial_log("SD init error: expected GPIO expander pin SD voltage select to be both "
 			   "an output and active high");
 		signal_error(ERROR_VC_NOT_INIT_MMC);
 	}
-	state = tag_gpio_get_state(GPIO_EXPANDER_VDD_SD_IO_SEL);
-	if (state) {
+	if (vc->sd_io_sel_state) {
 		serial_log("SD init error: GPIO expander pin SD voltage select has 1.8V selected, "
 			   "but expected 3.3V");
 		signal_error(ERROR_VC_NOT_INIT_MMC);
@@ -104,35 +185,28 @@ static void sd_assert_voltage(void)
 /**
  * @brief Assert that the card is supplied power. 
  */
-static void sd_assert_card_power(void)
+static void sd_assert_card_power(struct vc_boot_state *vc)
 {	
-	struct gpio_expander_pin_config cfg;
-	int state;
-
-	cfg = tag_gpio_get_config(GPIO_EXPANDER_SD_PWR_ON);
-	if (!gpio_config_pin_is_output(&cfg) || !gpio_config_pin_is_active_high(&cfg)) {
+	if (!gpio_config_pin_is_output(&vc->sd_pwr_on_cfg) || 
+	    !gpio_config_pin_is_active_high(&vc->sd_pwr_on_cfg)) {
 		serial_log("SD init error: expected GPIO expander pin SD card power to be both "
 			   "an output and active high");
 		signal_error(ERROR_VC_NOT_INIT_MMC);
 	}
-	state = tag_gpio_get_state(GPIO_EXPANDER_SD_PWR_ON);
-	if (!state) {
+	if (!vc->sd_pwr_on_state) {
 		serial_log("SD init error: GPIO expander pin SD card power not selected to supply power");
 		signal_error(ERROR_VC_NOT_INIT_MMC);
 	}
 }
 
-/**
- * @brief Assert that the VideoCore firmware which loaded this bootloader program set up
- *	  the MMC controller as expected.
- *
- * Signal error with error ERROR_VC_NOT_INIT_MMC if the assertion fails.
- */
-static void sd_assert_vc_init(void)
+void sd_assert_vc_init(void)
 {
-	sd_assert_base_clock();
-	sd_assert_voltage();
-	sd_assert_card_power();
+	/* The UART init has already requested this, so this doesn't need a round trip. */
+	struct vc_boot_state *vc = tag_boot_state();
+
+	sd_assert_base_clock(vc);
+	sd_assert_voltage(vc);
+	sd_assert_card_power(vc);
 }
 
 static bool sd_sw_reset_hc_bit_set(void)
@@ -164,14 +238,40 @@ static void sd_supply_bus_power(void)
 	register_enable_bits(&sd_access, CONTROL0, pwr_ctl_bits<<CONTROL0_PWR_CTL_SHIFT);
 }
 
+/**
+ * @brief Get whether the host controller implements version 3.00 of the SD Host 
+ *	  Controller spec, which adds the 10-bit clock divider.
+ */
+static bool sd_host_supports_10bit_clock_divider(void)
+{
+	uint32_t ver = register_get(&sd_access, SLOTISR_VER);
+	return (ver&SLOTISR_VER_SDVERSION)>>SLOTISR_VER_SDVERSION_SHIFT >= SDVERSION_3V00;
+}
+
+/**
+ * Get the 10-bit clock divider which when used in the clock control register
+ * SDCLK frequency select fields results in the base clock being divided to
+ * a clock rate <= the target clock rate. Unlike the 8-bit divider this isn't
+ * restricted to powers of 2, so gets the exact target clock rate whenever 
+ * the base clock rate is a multiple of twice the target.
+ */
+static int sd_10bit_clock_divider(uint32_t base_rate, uint32_t target_rate)
+{
+	/* A clock divider of N divides the base clock rate by 2N, or by 1 if N is 0. */
+	if (base_rate <= target_rate)
+		return 0;
+	/* Round up so the divided clock rate doesn't exceed the target. */
+	return (base_rate + 2*target_rate - 1)/(2*target_rate);
+}
+
 /**
  * Get the 8-bit clock divider which when used in the clock control register
  * SDCLK frequency select field results in the base clock being divided to
  * a clock rate <= the target clock rate.
  */
-static int sd_8bit_clock_divider(int base_rate, int target_rate)
+static int sd_8bit_clock_divider(uint32_t base_rate, uint32_t target_rate)
 {
-	int divisor = 1;
+	uint32_t divisor = 1;
 
 	/* 
 	 * A clock divider of N divides the base clock rate by 2N. In 8-bit
@@ -190,22 +290,31 @@ static bool sd_internal_clock_not_stable(void)
 
 /**
  * @brief Supply the clock at the given clock rate (in Hz) to the card.
+ * @return The actual clock rate supplied, which is <= the given clock rate.
  */
-static void sd_supply_clock(int clock_rate)
+static int sd_supply_clock(int clock_rate)
 {
-	/* 
-	 * Using 8-bit clock divider under the assumption that earlier cards won't support
-	 * the version 3 10-bit divider. 
-	 */
-	int clock_divider = sd_8bit_clock_divider(EMMC2_EXPECTED_BASE_CLOCK_HZ, clock_rate);
+	int clock_divider;
+
+	/* Fall back to the 8-bit clock divider for hosts older than version 3. */
+	if (sd_host_supports_10bit_clock_divider())
+		clock_divider = sd_10bit_clock_divider(base_clock_rate, clock_rate);
+	else
+		clock_divider = sd_8bit_clock_divider(base_clock_rate, clock_rate);
 
 	/* Turn off clock in case it was already on (required to change frequency). */
 	register_disable_bits(&sd_access, CONTROL1, CONTROL1_CLK_EN|CONTROL1_INT_CLK_EN);
 	/* Zero previous clock divider bits. */
-	register_disable_bits(&sd_access, CONTROL1, CONTROL1_CLK_FREQ_SEL);
-	/* Set clock divider and enable internal clock. */
+	register_disable_bits(&sd_access, CONTROL1, CONTROL1_CLK_FREQ_SEL|CONTROL1_CLK_FREQ_MS2);
+	/* 
+	 * Set clock divider and enable internal clock. The lower 8 bits of the divider go in
+	 * the frequency select field and the upper 2 bits (only non-zero for a 10-bit divider) 
+	 * in the most significant 2 bits field.
+	 */
 	register_enable_bits(&sd_access, CONTROL1, 
-			     clock_divider<<CONTROL1_CLK_FREQ_SEL_SHIFT | CONTROL1_INT_CLK_EN);
+			     (clock_divider&0xff)<<CONTROL1_CLK_FREQ_SEL_SHIFT 
+			     | (clock_divider>>8)<<CONTROL1_CLK_FREQ_MS2_SHIFT
+			     | CONTROL1_INT_CLK_EN);
 	/* 
 	 * Wait for internal clock to become stable. From testing this only takes 
 	 * around 5 iterations, so don't bother sleeping. 
@@ -213,6 +322,54 @@ static void sd_supply_clock(int clock_rate)
 	while_cond_timeout_infinite(sd_internal_clock_not_stable, 20);
 	/* Enable clock. */
 	register_enable_bits(&sd_access, CONTROL1, CONTROL1_CLK_EN);
+
+	return clock_divider ? base_clock_rate/(2*clock_divider) : base_clock_rate;
+}
+
+/** @brief Stop supplying the clock to the card, leaving the internal clock running. */
+static void sd_gate_clock(void)
+{
+	register_disable_bits(&sd_access, CONTROL1, CONTROL1_CLK_EN);
+}
+
+static void sd_ungate_clock(void)
+{
+	register_enable_bits(&sd_access, CONTROL1, CONTROL1_CLK_EN);
+}
+
+/** @brief Get the levels of lines DAT[3:0], one bit per line. */
+static int sd_dat_line_levels(void)
+{
+	return (register_get(&sd_access, STATUS)&STATUS_DAT_LEVEL0)>>STATUS_DAT_LEVEL0_SHIFT;
+}
+
+/** @brief Get whether the host controller supports any of the UHS-I bus speed modes. */
+static bool sd_host_supports_uhs(void)
+{
+	return register_get(&sd_access, CAPABILITIES1)
+	       &(CAPABILITIES1_SDR50_SUPPORT|CAPABILITIES1_SDR104_SUPPORT|CAPABILITIES1_DDR50_SUPPORT);
+}
+
+/**
+ * @brief Power cycle the card, putting it back in the idle state with 3.3V 
+ *	  signalling. This is the only way to get a card that has switched to 
+ *	  1.8V signalling back to 3.3V, or to recover a card that failed the 
+ *	  switch part way through.
+ */
+static void sd_power_cycle_card(struct card *card)
+{
+	register_disable_bits(&sd_access, CONTROL2, CONTROL2_1V8_EN);
+	tag_gpio_set_state(GPIO_EXPANDER_VDD_SD_IO_SEL, 0);
+	card->signalling_1v8 = false;
+
+	tag_gpio_set_state(GPIO_EXPANDER_SD_PWR_ON, 0);
+	/* Card supply must be held off for at least 1 ms for the card to see a power cycle. */
+	sleep(10);
+	tag_gpio_set_state(GPIO_EXPANDER_SD_PWR_ON, 1);
+	/* Wait for the card supply to ramp up. */
+	sleep(10);
+
+	card->state = CARD_STATE_IDLE;
 }
 
 static void sd_enable_interrupts(struct interrupt irpt)
@@ -250,16 +407,17 @@ static void sd_enable_transfer_interrupts(void)
 	irpt.data_timeout_error = true;
 	irpt.data_crc_error = true;
 	irpt.data_end_bit_error = true;
+	irpt.adma_error = true;
+	irpt.auto_cmd_error = true;
 
 	sd_enable_interrupts(irpt);
 }
 
 /**
- * @brief Do all of the intialisation needed to issue a command successfully.
+ * @brief Reset the host and do the intialisation needed to issue a command successfully.
  */
-static void sd_pre_cmd_init(void)
+static void sd_init_host(void)
 {
-	sd_assert_vc_init();
 	sd_reset_host();
 	sd_supply_bus_power();
 	/* 
@@ -270,14 +428,116 @@ static void sd_pre_cmd_init(void)
 	sd_enable_cmd_interrupts();
 }
 
+#if SD_WARM_INIT
 /**
- * Go through the card intialisation and identification process, moving the card
- * from the start of card identification mode to the start of data transfer mode.
+ * @brief Get the RCA of the card from the argument of the last command the firmware 
+ *	  issued, if it was an addressed command whose argument is the RCA. Must be 
+ *	  called before the host is reset.
+ * @return The RCA, or 0 if it's not known.
+ */
+static int sd_firmware_rca(void)
+{
+	struct cmdtm cmdtm;
+
+	register_get_out(&sd_access, CMDTM, &cmdtm);
+	switch (cmdtm.cmd_index) {
+		case CMD_IDX_SELECT_CARD:
+		case CMD_IDX_SEND_CSD:
+		case CMD_IDX_SEND_STATUS:
+		case CMD_IDX_APP_CMD:
+			return register_get(&sd_access, ARG1)>>16;
+	}
+	return 0;
+}
+
+/**
+ * Reuse the card as the firmware left it, moving it to the standby state (the state 
+ * identification finishes in) without identifying it again. 
+ *
+ * @param rca The card's RCA if known from sd_firmware_rca(), otherwise 0
+ */
+static enum sd_init_error sd_card_warm_identify(struct card *card, int rca)
+{
+	struct card_status cs;
+
+	if (rca) {
+		/* Probe that the card is still at the RCA and already past identification. */
+		if (sd_issue_cmd13(rca, &cs) != CMD_ERROR_NONE)
+			return SD_INIT_ERROR_ISSUE_CMD;
+		if (cs.current_state != CARD_STATE_STANDBY && cs.current_state != CARD_STATE_TRANSFER)
+			return SD_INIT_ERROR_ISSUE_CMD;
+	}
+	/* A card in the transfer state must be in the standby state to send its CSD. */
+	if (sd_issue_cmd7_deselect() != CMD_ERROR_NONE)
+		return SD_INIT_ERROR_ISSUE_CMD;
+	/* Without the RCA have the card publish a new one, which it only does once identified. */
+	if (!rca && sd_issue_cmd3(&rca) != CMD_ERROR_NONE)
+		return SD_INIT_ERROR_ISSUE_CMD;
+	card->rca = rca;
+
+	if (sd_issue_cmd9(card->rca, &card->sdhc_or_sdxc, &card->nblks) != CMD_ERROR_NONE)
+		return SD_INIT_ERROR_ISSUE_CMD;
+
+	card->state = CARD_STATE_STANDBY;
+	return SD_INIT_ERROR_NONE;
+}
+#endif
+
+/**
+ * @brief Switch both the card and host from 3.3V to 1.8V signalling, following
+ *	  the signal voltage switch sequence in section '3.6.1 Signal Voltage 
+ *	  Switch Procedure' of the SD Host Controller spec. Requires the card 
+ *	  accepted 1.8V signalling in its ACMD41 response.
+ *
+ * @return SD_INIT_ERROR_VOLTAGE_SWITCH if the switch failed, in which case the card
+ *	   must be power cycled before it can be used again.
  */
-static enum sd_init_error sd_card_init_and_identify(struct card *card)
+static enum sd_init_error sd_switch_signal_voltage(struct card *card)
+{
+	enum cmd_error error;
+
+	error = sd_issue_cmd(CMD_IDX_VOLTAGE_SWITCH, 0);
+	if (error != CMD_ERROR_NONE)
+		goto fail;
+	/* The card drives CMD and DAT[3:0] low once it has started switching. */
+	sd_gate_clock();
+	if (sd_dat_line_levels() != 0)
+		goto fail;
+	/* 
+	 * The host's 1.8V enable only changes its own signalling: the supply for the
+	 * IO lines is from a regulator selected by the GPIO expander.
+	 */
+	tag_gpio_set_state(GPIO_EXPANDER_VDD_SD_IO_SEL, 1);
+	register_enable_bits(&sd_access, CONTROL2, CONTROL2_1V8_EN);
+	/* Wait for the signal voltage regulator output to be stable. */
+	sleep(5);
+	if (!(register_get(&sd_access, CONTROL2)&CONTROL2_1V8_EN))
+		goto fail;
+	sd_ungate_clock();
+	/* The card releases DAT[3:0] high within 1 ms of the clock being supplied. */
+	sleep(1);
+	if (sd_dat_line_levels() != 0xf)
+		goto fail;
+
+	card->signalling_1v8 = true;
+	return SD_INIT_ERROR_NONE;
+fail:
+	serial_log("SD init error: failed to switch to 1.8V signalling");
+	sd_ungate_clock();
+	return SD_INIT_ERROR_VOLTAGE_SWITCH;
+}
+
+/**
+ * Start the card intialisation process, leaving the card powering up, which is
+ * polled for with sd_poll_acmd41() before going on to sd_card_identify().
+ *
+ * @param request_1v8 Whether to request 1.8V signalling
+ * @param[out] poll_out State to pass to sd_poll_acmd41()
+ */
+static enum sd_init_error sd_card_init_start(struct card *card, bool request_1v8, 
+					     struct acmd41_poll *poll_out)
 {
 	enum cmd_error error;
-	bool ccs;
 
 	card->state = CARD_STATE_IDLE;
 
@@ -298,15 +558,37 @@ static enum sd_init_error sd_card_init_and_identify(struct card *card)
 	if (error != CMD_ERROR_NONE) 
 		return SD_INIT_ERROR_ISSUE_CMD;
 
-	error = sd_issue_acmd41(&ccs);
+	error = sd_start_acmd41(request_1v8, poll_out);
 	if (error == CMD_ERROR_RESPONSE_CONTENTS) 
 		return SD_INIT_ERROR_UNUSABLE_CARD;
 	if (error != CMD_ERROR_NONE) 
 		return SD_INIT_ERROR_ISSUE_CMD;
-	card->sdhc_or_sdxc = ccs;
+	return SD_INIT_ERROR_NONE;
+}
 
+/**
+ * Finish the card intialisation and identification process once the card has
+ * powered up, moving the card to the start of data transfer mode.
+ *
+ * @param ccs Card capacity status from the card's power up
+ * @param accept_1v8 Whether the card accepted 1.8V signalling
+ */
+static enum sd_init_error sd_card_identify(struct card *card, bool ccs, bool accept_1v8)
+{
+	enum sd_init_error sd_init_error;
+	enum cmd_error error;
+	bool csd_sdhc_or_sdxc;
+
+	card->sdhc_or_sdxc = ccs;
 	card->state = CARD_STATE_READY;
 
+	/* The switch must be done in the ready state, before CMD2. */
+	if (accept_1v8) {
+		sd_init_error = sd_switch_signal_voltage(card);
+		if (sd_init_error != SD_INIT_ERROR_NONE)
+			return sd_init_error;
+	}
+
 	/* Issue CMD2. */
 	error = sd_issue_cmd(CMD_IDX_ALL_SEND_CID, 0);
 	if (error != CMD_ERROR_NONE) 
@@ -319,10 +601,35 @@ static enum sd_init_error sd_card_init_and_identify(struct card *card)
 		return SD_INIT_ERROR_ISSUE_CMD;
 
 	card->state = CARD_STATE_STANDBY;
+	/* Get the card's capacity. Its capacity status is already known from ACMD41. */
+	error = sd_issue_cmd9(card->rca, &csd_sdhc_or_sdxc, &card->nblks);
+	if (error != CMD_ERROR_NONE) 
+		return SD_INIT_ERROR_ISSUE_CMD;
 	return SD_INIT_ERROR_NONE;
 }
 
-static enum sd_init_error sd_set_4bit_data_bus_width(int rca)
+/**
+ * Go through the card intialisation and identification process, moving the card
+ * from the start of card identification mode to the start of data transfer mode,
+ * waiting for the card to power up.
+ *
+ * @param request_1v8 Whether to switch to 1.8V signalling if the card accepts it
+ */
+static enum sd_init_error sd_card_init_and_identify(struct card *card, bool request_1v8)
+{
+	struct acmd41_poll poll;
+	enum sd_init_error sd_init_error;
+	bool ccs, accept_1v8;
+
+	sd_init_error = sd_card_init_start(card, request_1v8, &poll);
+	if (sd_init_error != SD_INIT_ERROR_NONE)
+		return sd_init_error;
+	if (sd_wait_acmd41(&poll, &ccs, &accept_1v8) != CMD_ERROR_NONE)
+		return SD_INIT_ERROR_ISSUE_CMD;
+	return sd_card_identify(card, ccs, accept_1v8);
+}
+
+static enum sd_init_error sd_set_data_bus_width(struct card *card, bool four_bit)
 {
 	struct interrupt irpt_mask;
 	enum cmd_error error;
@@ -334,42 +641,257 @@ static enum sd_init_error sd_set_4bit_data_bus_width(int rca)
 	irpt_mask.card = 1;
 	register_disable_bits(&sd_access, IRPT_MASK, cast_bitfields(irpt_mask, uint32_t));
 
-	/* Change card to 4-bit data bus width. */
-	error = sd_issue_acmd6(rca, true);
+	/* Change card data bus width. */
+	error = sd_issue_acmd6(card->rca, four_bit);
 	if (error == CMD_ERROR_NONE) {
-		/* Change host to 4-bit data bus width. */
-		register_enable_bits(&sd_access, CONTROL0, CONTROL0_DATA_TRANSFER_WIDTH);
+		/* Change host data bus width to match. */
+		if (four_bit)
+			register_enable_bits(&sd_access, CONTROL0, CONTROL0_DATA_TRANSFER_WIDTH);
+		else
+			register_disable_bits(&sd_access, CONTROL0, CONTROL0_DATA_TRANSFER_WIDTH);
+		card->four_bit_bus = four_bit;
 	}
 	register_set(&sd_access, IRPT_MASK, prev_irpt_mask);
 	return error == CMD_ERROR_NONE ? SD_INIT_ERROR_NONE : SD_INIT_ERROR_ISSUE_CMD;
 }
 
-enum sd_init_error sd_init_card(struct card *card_out)
+static char *strbusmode(enum bus_mode mode)
+{
+	switch (mode) {
+		case BUS_MODE_DEFAULT_SPEED:
+			return "default speed";
+		case BUS_MODE_HIGH_SPEED:
+			return "high speed";
+		case BUS_MODE_SDR50:
+			return "SDR50";
+		case BUS_MODE_SDR104:
+			return "SDR104";
+		case BUS_MODE_DDR50:
+			return "DDR50";
+	}
+}
+
+/** @return The max clock rate of a bus speed mode, in Hz. */
+static int bus_mode_clock_rate(enum bus_mode mode)
+{
+	switch (mode) {
+		case BUS_MODE_DEFAULT_SPEED:
+			return DEFAULT_SPEED_CLOCK_RATE_HZ;
+		case BUS_MODE_HIGH_SPEED:
+			return HIGH_SPEED_CLOCK_RATE_HZ;
+		case BUS_MODE_SDR50:
+			return SDR50_CLOCK_RATE_HZ;
+		case BUS_MODE_SDR104:
+			return SDR104_CLOCK_RATE_HZ;
+		case BUS_MODE_DDR50:
+			return DDR50_CLOCK_RATE_HZ;
+	}
+}
+
+/** @brief Get whether the host controller supports a bus speed mode. */
+static bool sd_host_supports_bus_mode(enum bus_mode mode)
+{
+	uint32_t caps = register_get(&sd_access, CAPABILITIES1);
+
+	switch (mode) {
+		case BUS_MODE_DEFAULT_SPEED:
+		case BUS_MODE_HIGH_SPEED:
+			return true;
+		case BUS_MODE_SDR50:
+			return caps&CAPABILITIES1_SDR50_SUPPORT;
+		case BUS_MODE_SDR104:
+			return caps&CAPABILITIES1_SDR104_SUPPORT;
+		case BUS_MODE_DDR50:
+			return caps&CAPABILITIES1_DDR50_SUPPORT;
+	}
+}
+
+/** @brief Get whether the host's sampling clock must be tuned to use a bus speed mode. */
+static bool bus_mode_requires_tuning(enum bus_mode mode)
+{
+	return mode == BUS_MODE_SDR104 || (mode == BUS_MODE_SDR50 && 
+	       register_get(&sd_access, CAPABILITIES1)&CAPABILITIES1_SDR50_TUNING);
+}
+
+/**
+ * @brief Set the host's bus speed mode timing and clock. The clock is stopped while
+ *	  the timing changes.
+ */
+static void sd_set_host_bus_mode(struct card *card, enum bus_mode mode)
+{
+	int clock_rate = bus_mode_clock_rate(mode);
+
+	sd_gate_clock();
+	if ((uint32_t)clock_rate > base_clock_rate)
+		sd_raise_base_clock(clock_rate);
+	if (mode == BUS_MODE_DEFAULT_SPEED)
+		register_disable_bits(&sd_access, CONTROL0, CONTROL0_HS_EN);
+	else
+		register_enable_bits(&sd_access, CONTROL0, CONTROL0_HS_EN);
+	/* The UHS mode select field is only used with 1.8V signalling. */
+	if (card->signalling_1v8) {
+		register_disable_bits(&sd_access, CONTROL2, CONTROL2_UHSMODE);
+		register_enable_bits(&sd_access, CONTROL2, mode<<CONTROL2_UHSMODE_SHIFT);
+	}
+	card->clock_rate = sd_supply_clock(clock_rate);
+}
+
+static bool sd_tuning_in_progress(void)
+{
+	return register_get(&sd_access, CONTROL2)&CONTROL2_TUNEON;
+}
+
+/**
+ * @brief Tune the host's sampling clock by having the card send tuning blocks, following
+ *	  the sampling clock tuning procedure of the SD Host Controller spec. Requires the 
+ *	  host and card already be in the bus speed mode being tuned for.
+ *
+ * @return Whether tuning completed with the tuned clock selected.
+ */
+static bool sd_execute_tuning(void)
+{
+	enum cmd_error error;
+	int i;
+
+	register_enable_bits(&sd_access, CONTROL2, CONTROL2_TUNEON);
+	/* The host clears execute tuning once it has finished tuning. */
+	for (i = 0; i < TUNING_MAX_BLOCKS && sd_tuning_in_progress(); ++i) {
+		error = sd_issue_cmd19();
+		if (error != CMD_ERROR_NONE)
+			break;
+	}
+	if (!sd_tuning_in_progress() && register_get(&sd_access, CONTROL2)&CONTROL2_TUNED)
+		return true;
+
+	/* Abort tuning and go back to sampling with the fixed clock. */
+	register_disable_bits(&sd_access, CONTROL2, CONTROL2_TUNEON|CONTROL2_TUNED);
+	serial_log("SD init error: sampling clock tuning failed after %u tuning blocks", i);
+	return false;
+}
+
+/**
+ * @brief Switch both the card and host to a bus speed mode with CMD6, and raise the clock
+ *	  to the mode's max clock rate. Requires the card be in the transfer state.
+ *
+ * @return Whether switched. If not switched both the card and host are left in the
+ *	   bus speed mode they were already in.
+ */
+static bool sd_switch_bus_mode(struct card *card, enum bus_mode mode)
+{
+	struct switch_status status;
+	enum cmd_error error;
+
+	/* Check the card supports the mode before switching to it. */
+	error = sd_issue_cmd6(false, mode, &status);
+	if (error != CMD_ERROR_NONE || !(status.group1_support&BIT(mode)) || 
+	    status.group1_selection != mode) 
+		return false;
+	error = sd_issue_cmd6(true, mode, &status);
+	if (error != CMD_ERROR_NONE || status.group1_selection != mode) {
+		serial_log("SD init error: failed to switch card to %s bus mode", strbusmode(mode));
+		return false;
+	}
+	/* 
+	 * The card switches within 8 clocks of the end of the switch function status,
+	 * so by now it's safe to change the host's timing and clock to match.
+	 */
+	sd_set_host_bus_mode(card, mode);
+
+	if (bus_mode_requires_tuning(mode) && !sd_execute_tuning()) {
+		/* 
+		 * The card is left in the mode, but without a tuned sampling clock its 
+		 * data can't be sampled reliably at the mode's clock rate. Drop back to
+		 * default speed timing and clock, which any mode can run at, so that the
+		 * card can be switched to a slower mode.
+		 */
+		sd_set_host_bus_mode(card, BUS_MODE_DEFAULT_SPEED);
+		card->bus_mode = BUS_MODE_DEFAULT_SPEED;
+		return false;
+	}
+	card->bus_mode = mode;
+	return true;
+}
+
+/** @brief Bus speed modes, fastest first. */
+static enum bus_mode bus_modes[] = { 
+	BUS_MODE_SDR104, BUS_MODE_SDR50, BUS_MODE_DDR50, BUS_MODE_HIGH_SPEED, BUS_MODE_DEFAULT_SPEED
+};
+
+/** @brief Get whether a bus speed mode can be used with the card's signal voltage and host. */
+static bool sd_bus_mode_usable(struct card *card, enum bus_mode mode)
+{
+	/* High speed is the only mode faster than default speed at 3.3V. */
+	if (!card->signalling_1v8 && mode != BUS_MODE_HIGH_SPEED && mode != BUS_MODE_DEFAULT_SPEED)
+		return false;
+	return sd_host_supports_bus_mode(mode);
+}
+
+/**
+ * @brief Switch to the fastest bus speed mode supported by both the card and host.
+ *	  Requires the card be in the transfer state with a 4-bit data bus width.
+ */
+static void sd_switch_fastest_bus_mode(struct card *card)
+{
+	int i;
+
+	/* The card is already in default speed, so stop before it. */
+	for (i = 0; bus_modes[i] != BUS_MODE_DEFAULT_SPEED; ++i) {
+		if (sd_bus_mode_usable(card, bus_modes[i]) && sd_switch_bus_mode(card, bus_modes[i]))
+			return;
+	}
+}
+
+/**
+ * @brief Step the bus down to the next slower bus speed mode, or if already at default
+ *	  speed, to a 1-bit data bus width. Requires the card be in the transfer state.
+ * @return Whether stepped down, false if the bus is already at its slowest.
+ */
+static bool sd_step_down_bus(struct card *card)
+{
+	int i;
+
+	/* Skip to the modes slower than the current one. */
+	for (i = 0; bus_modes[i] != card->bus_mode; ++i)
+		;
+	for (++i; i < array_len(bus_modes); ++i) {
+		if (sd_bus_mode_usable(card, bus_modes[i]) && sd_switch_bus_mode(card, bus_modes[i])) {
+			serial_log("SD: stepped down to %s bus mode, %u KHz clock", 
+				   strbusmode(card->bus_mode), card->clock_rate/1000);
+			return true;
+		}
+	}
+	if (card->four_bit_bus && sd_set_data_bus_width(card, false) == SD_INIT_ERROR_NONE) {
+		serial_log("SD: stepped down to 1-bit data bus width");
+		return true;
+	}
+	return false;
+}
+
+/**
+ * @brief Finish initialising a card in the standby state, putting it in the transfer 
+ *	  state ready for reads.
+ *
+ * @param warm Whether the card was reused as left by the firmware instead of identified
+ */
+static enum sd_init_error sd_init_card_transfer(struct card *card_out, bool warm)
 {
 	enum sd_init_error sd_init_error;
 	enum cmd_error cmd_error;
 	struct card_status cs;
 	struct scr scr;
-
-	serial_log("Initialising SD...");
-	mzero(card_out, sizeof(struct card));
-
-	sd_pre_cmd_init();
-	/* After sd_pre_cmd_init() have a 1-bit data bus width and <= 400 KHz clock. */
-	sd_init_error = sd_card_init_and_identify(card_out);
-	if (sd_init_error != SD_INIT_ERROR_NONE)
-		return sd_init_error;
+	bool dma;
 
 	/*
-	 * Given that this is called after sd_assert_vc_init() it can safely be assumed 
-	 * that 3.3V power is being supplied. The only two bus speed modes supported at 
-	 * 3.3V are default speed and high speed. Default speed has a max clock speed of 
-	 * 25 MHz, and high speed 50 MHz. High speed mode requires setting a register 
-	 * field to use; because the register fields relevant to bus speed modes are reset 
-	 * to 0x0 on boot, default speed can be assumed - change the clock to 25 MHz for 
+	 * The only two bus speed modes supported at 3.3V are default speed and high speed. 
+	 * Default speed has a max clock speed of 25 MHz, and high speed 50 MHz. At 1.8V
+	 * there are also the UHS-I modes SDR50, DDR50, and SDR104. All but default speed 
+	 * require switching the card to it with CMD6, which can only be done in the transfer 
+	 * state; because the register fields relevant to bus speed modes are reset to 0x0 on 
+	 * boot, default speed can be assumed until then - change the clock to 25 MHz for 
 	 * default speed.
 	 */
-	sd_supply_clock(DEFAULT_SPEED_CLOCK_RATE_HZ);
+	sd_set_host_bus_mode(card_out, BUS_MODE_DEFAULT_SPEED);
+	card_out->bus_mode = BUS_MODE_DEFAULT_SPEED;
 
 	/* Put card in transfer state. */
 	cmd_error = sd_issue_cmd7(card_out->rca);
@@ -387,6 +909,18 @@ enum sd_init_error sd_init_card(struct card *card_out)
 	card_out->state = CARD_STATE_TRANSFER;
 
 	sd_enable_transfer_interrupts();
+	/* Have the host controller copy read data into RAM itself, if it's able to. */
+	dma = adma2_select();
+
+	/* 
+	 * The firmware may have left the card at 4-bit data bus width, but the host has 
+	 * been reset to 1-bit: bring the card back in line before reading its SCR.
+	 */
+	if (warm) {
+		sd_init_error = sd_set_data_bus_width(card_out, false);
+		if (sd_init_error != SD_INIT_ERROR_NONE)
+			return sd_init_error;
+	}
 
 	/* Check card's configuration register for support info. */
 	cmd_error = sd_issue_acmd51(card_out->rca, &scr);
@@ -394,98 +928,304 @@ enum sd_init_error sd_init_card(struct card *card_out)
 		return SD_INIT_ERROR_ISSUE_CMD;
 	card_out->cmd23_supported = scr.cmd23_supported;
 
-	/* Set 4-bit data bus width if supported. */
+	/* 
+	 * Set 4-bit data bus width if supported. It's mandatory for a card which 
+	 * accepted 1.8V signalling, as the UHS-I modes only use 4-bit.
+	 */
 	if (scr.bus_widths&SCR_BUS_WIDTHS_4BIT) {
-		sd_init_error = sd_set_4bit_data_bus_width(card_out->rca);
+		sd_init_error = sd_set_data_bus_width(card_out, true);
 		if (sd_init_error != SD_INIT_ERROR_NONE)
 			return sd_init_error;
+		/* Switch to a faster bus speed mode if the card implements CMD6 and supports it. */
+		if (scr.sd_spec >= SCR_SD_SPEC_1V10)
+			sd_switch_fastest_bus_mode(card_out);
 	}
-	serial_log("Successfully initialised SD: %s capacity, CMD23 %s, "
-		   "%s-bit data bus width, 25 MHz clock, default speed bus mode",
+
+	serial_log("Successfully initialised SD (%s): %s capacity, CMD23 %s, "
+		   "%s-bit data bus width, %sV signalling, %u KHz clock, %s bus mode, %s transfers",
+		   warm ? "reused from firmware" : "identified",
 		   card_out->sdhc_or_sdxc ? "SDHC/SDXC" : "SDSC",
 		   card_out->cmd23_supported ? "supported" : "not supported",
-		   scr.bus_widths&SCR_BUS_WIDTHS_4BIT ? "4" : "1");
+		   card_out->four_bit_bus ? "4" : "1",
+		   card_out->signalling_1v8 ? "1.8" : "3.3",
+		   card_out->clock_rate/1000,
+		   strbusmode(card_out->bus_mode),
+		   dma ? "ADMA2" : "DATA register");
 	return SD_INIT_ERROR_NONE;
 }
 
 static struct card card;
 
+/**
+ * @brief Progress of an initialisation started with sd_init_start().
+ */
+static struct {
+	bool powering_up;  /**< Whether the card's power up is still being polled */
+	bool warm;  /**< Whether the card was reused as left by the firmware */
+	struct acmd41_poll acmd41;
+} init;
+
+enum sd_init_error sd_init_start(void)
+{
+	enum sd_init_error sd_init_error;
+#if SD_WARM_INIT
+	/* Get this before the host is reset and forgets it. */
+	int firmware_rca = sd_firmware_rca();
+#endif
+
+	serial_log("Initialising SD...");
+	mzero(&card, sizeof(card));
+	mzero(&init, sizeof(init));
+
+	sd_init_host();
+	/* After sd_init_host() have a 1-bit data bus width and <= 400 KHz clock. */
+#if SD_WARM_INIT
+	init.warm = sd_card_warm_identify(&card, firmware_rca) == SD_INIT_ERROR_NONE;
+	if (init.warm)
+		return SD_INIT_ERROR_NONE;
+	serial_log("SD: couldn't reuse card as left by firmware, identifying it");
+	/* Clear any error state left on the host by the failed attempt. */
+	sd_init_host();
+	mzero(&card, sizeof(card));
+#endif
+	/*
+	 * Given that this is called after sd_assert_vc_init() it can safely be assumed 
+	 * that 3.3V signalling is being used, but request 1.8V signalling for the UHS-I
+	 * bus speed modes if the host supports them.
+	 */
+	sd_init_error = sd_card_init_start(&card, sd_host_supports_uhs(), &init.acmd41);
+	if (sd_init_error != SD_INIT_ERROR_NONE)
+		return sd_init_error;
+	init.powering_up = true;
+	return SD_INIT_ERROR_NONE;
+}
+
+enum sd_init_error sd_init_poll(bool *done_out)
+{
+	enum sd_init_error sd_init_error;
+	bool powered_up, ccs, accept_1v8;
+
+	*done_out = false;
+	if (init.powering_up) {
+		if (sd_poll_acmd41(&init.acmd41, &powered_up, &ccs, &accept_1v8) != CMD_ERROR_NONE)
+			return SD_INIT_ERROR_ISSUE_CMD;
+		if (!powered_up)
+			return SD_INIT_ERROR_NONE;
+		init.powering_up = false;
+
+		sd_init_error = sd_card_identify(&card, ccs, accept_1v8);
+		if (sd_init_error == SD_INIT_ERROR_VOLTAGE_SWITCH) {
+			/* Fall back to 3.3V signalling: the card only goes back to it after a power cycle. */
+			sd_power_cycle_card(&card);
+			sd_supply_clock(IDENTIFICATION_CLOCK_RATE_HZ);
+			sd_init_error = sd_card_init_and_identify(&card, false);
+		}
+		if (sd_init_error != SD_INIT_ERROR_NONE)
+			return sd_init_error;
+	}
+	sd_init_error = sd_init_card_transfer(&card, init.warm);
+	*done_out = true;
+	return sd_init_error;
+}
+
 enum sd_init_error sd_init(void)
 {
-	return sd_init_card(&card);
+	enum sd_init_error sd_init_error;
+	bool done;
+
+	sd_assert_vc_init();
+	sd_init_error = sd_init_start();
+	if (sd_init_error != SD_INIT_ERROR_NONE)
+		return sd_init_error;
+	do {
+		sd_init_error = sd_init_poll(&done);
+	} while (sd_init_error == SD_INIT_ERROR_NONE && !done);
+	return sd_init_error;
 }
 
-static bool _sd_read_blocks_card(byte_t *ram_dest_addr, uint32_t sd_src_lba, uint16_t nblks, 
-				 struct card *card)
+/**
+ * @brief A read started with sd_read_submit() that hasn't been waited on yet.
+ */
+static struct {
+	bool pending;
+	byte_t *ram_dest_addr;
+	uint32_t sd_src_lba;
+	int nblks;
+} submitted_read;
+
+static void sd_log_read_error(byte_t *ram_dest_addr, uint32_t sd_src_lba, int nblks)
 {
-	enum cmd_error error = CMD_ERROR_NONE;
-	void *sd_src_addr = (void *)sd_src_lba;
+	serial_log("SD read error: RAM dest addr %08x, SD src LBA %08x, number "
+		   "of blocks %u", ram_dest_addr, sd_src_lba, nblks);
+}
 
+static bool sd_read_dest_aligned(byte_t *ram_dest_addr)
+{
 	if (!address_aligned(ram_dest_addr, 4)) {
 		serial_log("SD read error: RAM destination address %08x not 4-byte aligned",
 			   ram_dest_addr);
 		return false;
 	}
+	return true;
+}
+
+/**
+ * @brief Start reading blocks, leaving the read in flight if it's done with ADMA2.
+ *	  Requires the destination be checked with sd_read_dest_aligned().
+ * @return Whether the read was started successfully.
+ */
+static bool sd_read_blocks_card_submit(byte_t *ram_dest_addr, uint32_t sd_src_lba, int nblks, 
+				       struct card *card)
+{
+	void *sd_src_addr = (void *)sd_src_lba;
+	/*
+	 * Without CMD23 the card doesn't know how many blocks to send, so a multi block
+	 * read is open-ended and stopped by CMD12 once the last block is read.
+	 */
+	enum auto_cmd auto_cmd = card->cmd23_supported ? AUTO_CMD_CMD23 : AUTO_CMD_CMD12;
+
+	if (nblks <= 0)
+		return true;
 	/* Convert LBA / block unit address to byte unit address for SDSC. */
 	if (!card->sdhc_or_sdxc) 
 		sd_src_addr = (void *)(sd_src_lba*SD_BLKSZ);
 	
-	if (nblks == 1) {
-		/* Single block transfer. */
-		error = sd_issue_cmd17(ram_dest_addr, sd_src_addr);
-	} else if (nblks > 1) {
-		/* Multi block transfer. */
-		if (card->cmd23_supported) {
-			/* Read all blocks in one multi block transfer. */
-			error = sd_issue_cmd(CMD_IDX_SET_BLOCK_COUNT, nblks);
-			if (error == CMD_ERROR_NONE) 
-				error = sd_issue_cmd18(ram_dest_addr, sd_src_addr, nblks);
-		} else {
-			/* Read all blocks over multiple single block transfers. */
-			for (; nblks; --nblks) {
-				error = sd_issue_cmd17(ram_dest_addr, sd_src_addr);
-				if (error != CMD_ERROR_NONE)
-					break;
-				ram_dest_addr += SD_BLKSZ;
-				sd_src_addr += card->sdhc_or_sdxc ? 1 : SD_BLKSZ;  /* As above. */
-			}
+	return sd_submit_read_cmd(ram_dest_addr, sd_src_addr, nblks, auto_cmd) == CMD_ERROR_NONE;
+}
+
+/**
+ * @brief Retry a read which failed, skipping the blocks at its start that were read
+ *	  before it failed. Only bus errors are retried, and if they keep happening the
+ *	  bus is stepped down to a slower speed or width, trading speed for reliability.
+ *	  Requires the read be the last one that failed.
+ *
+ * @return Whether a retry succeeded.
+ */
+static bool sd_retry_read(byte_t *ram_dest_addr, uint32_t sd_src_lba, int nblks, 
+			  struct card *card)
+{
+	int retries, nblks_done;
+
+	for (retries = 0; retries < READ_MAX_RETRIES; ++retries) {
+		if (sd_last_error_kind() == CMD_ERROR_KIND_OTHER)
+			return false;
+		nblks_done = sd_failed_read_nblks_done();
+		ram_dest_addr += nblks_done*SD_BLKSZ;
+		sd_src_lba += nblks_done;
+		nblks -= nblks_done;
+
+		if (++card->bus_errors >= BUS_ERRORS_BEFORE_STEP_DOWN) {
+			card->bus_errors = 0;
+			sd_step_down_bus(card);
 		}
+		serial_log("SD: retrying read of %u blocks from LBA %08x", nblks, sd_src_lba);
+		if (sd_read_blocks_card_submit(ram_dest_addr, sd_src_lba, nblks, card) &&
+		    sd_wait_read_cmd() == CMD_ERROR_NONE)
+			return true;
 	}
-	if (error != CMD_ERROR_NONE) 
-		serial_log("SD read error: RAM dest addr %08x, SD src addr %08x, number "
-			   "of blocks %u", ram_dest_addr, sd_src_addr, nblks);
-	return error == CMD_ERROR_NONE;
+	return false;
+}
+
+static bool _sd_read_blocks_card(byte_t *ram_dest_addr, uint32_t sd_src_lba, int nblks, 
+				 struct card *card)
+{
+	if (sd_read_blocks_card_submit(ram_dest_addr, sd_src_lba, nblks, card) &&
+	    sd_wait_read_cmd() == CMD_ERROR_NONE)
+		return true;
+	if (sd_retry_read(ram_dest_addr, sd_src_lba, nblks, card))
+		return true;
+	sd_log_read_error(ram_dest_addr, sd_src_lba, nblks);
+	return false;
 }
 
 static bool sd_read_blocks_card(byte_t *ram_dest_addr, uint32_t sd_src_lba, int nblks, 
 				struct card *card)
 {
 	bool read_ok;
+	/* 
+	 * Read command block count field is only 16 bits wide, meaning a multi block
+	 * transfer through the DATA register can only read up to ~33.55 MB, so must read 
+	 * in multiple passes if read size is greater than this. An ADMA2 transfer is
+	 * instead sized by its chained descriptors, so it reads everything in one pass.
+	 */
+	int pass_nblks = adma2_selected() ? nblks : UINT16_MAX;
 
+	if (!sd_read_dest_aligned(ram_dest_addr))
+		return false;
 	while (nblks > 0) {
-		/* 
-		 * Read command block count field is only 16 bits wide, meaning a multi block
-		 * transfer can only read up to ~33.55 MB, so must read in multiple passes
-		 * if read size is greater than this.
-		 */
-		read_ok = _sd_read_blocks_card(ram_dest_addr, sd_src_lba, 
-					       nblks < UINT16_MAX ? nblks : UINT16_MAX,
+		read_ok = _sd_read_blocks_card(ram_dest_addr, sd_src_lba, min(nblks, pass_nblks), 
 					       card);
 		if (!read_ok)
 			return false;
 
-		nblks -= UINT16_MAX;
-		ram_dest_addr += SD_BLKSZ*UINT16_MAX;
-		sd_src_lba += UINT16_MAX;
+		nblks -= pass_nblks;
+		ram_dest_addr += SD_BLKSZ*pass_nblks;
+		sd_src_lba += pass_nblks;
 	}
 	return true;
 }
 
 bool sd_read_blocks(byte_t *ram_dest_addr, uint32_t sd_src_lba, int nblks)
 {
+	if (submitted_read.pending) {
+		serial_log("SD read error: submitted read not waited on before reading");
+		return false;
+	}
 	return sd_read_blocks_card(ram_dest_addr, sd_src_lba, nblks, &card);
 }
 
+bool sd_read_submit(byte_t *ram_dest_addr, uint32_t sd_src_lba, int nblks)
+{
+	if (!sd_read_wait())
+		return false;
+	/* 
+	 * Reading through the DATA register keeps the CPU busy for the whole read anyway,
+	 * and may take multiple passes, so just read synchronously.
+	 */
+	if (!adma2_selected())
+		return sd_read_blocks_card(ram_dest_addr, sd_src_lba, nblks, &card);
+
+	if (!sd_read_dest_aligned(ram_dest_addr))
+		return false;
+	if (!sd_read_blocks_card_submit(ram_dest_addr, sd_src_lba, nblks, &card)) {
+		/* Nothing is left in flight, so retry synchronously. */
+		if (sd_retry_read(ram_dest_addr, sd_src_lba, nblks, &card))
+			return true;
+		sd_log_read_error(ram_dest_addr, sd_src_lba, nblks);
+		return false;
+	}
+	submitted_read.pending = true;
+	submitted_read.ram_dest_addr = ram_dest_addr;
+	submitted_read.sd_src_lba = sd_src_lba;
+	submitted_read.nblks = nblks;
+	return true;
+}
+
+bool sd_read_poll(void)
+{
+	return submitted_read.pending && sd_poll_read_cmd();
+}
+
+bool sd_read_wait(void)
+{
+	if (!submitted_read.pending)
+		return true;
+	submitted_read.pending = false;
+
+	if (sd_wait_read_cmd() == CMD_ERROR_NONE ||
+	    sd_retry_read(submitted_read.ram_dest_addr, submitted_read.sd_src_lba,
+			  submitted_read.nblks, &card))
+		return true;
+	sd_log_read_error(submitted_read.ram_dest_addr, submitted_read.sd_src_lba, 
+			  submitted_read.nblks);
+	return false;
+}
+
+uint32_t sd_nblks(void)
+{
+	return card.nblks;
+}
+
 int bytes_to_blocks(int bytes)
 {
 	int nblks = bytes/SD_BLKSZ;
@@ -510,8 +1250,16 @@ static bool sd_reset_card(struct card *card)
 		return false;
 
 	card->state = CARD_STATE_IDLE;
+	/* 
+	 * CMD0 doesn't change the signal voltage, so power cycle a card switched to 1.8V
+	 * back to the 3.3V signalling the next stage expects at boot.
+	 */
+	if (card->signalling_1v8)
+		sd_power_cycle_card(card);
 
 	sd_reset_host();
+	/* The host reset stops the card's clock, so the base clock can now be changed. */
+	sd_restore_base_clock();
 	return true;
 }
 
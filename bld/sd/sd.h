@@ -12,21 +12,57 @@
 enum sd_init_error {
 	SD_INIT_ERROR_NONE,
 	SD_INIT_ERROR_ISSUE_CMD,  /**< Error issuing a SD command */
-	SD_INIT_ERROR_UNUSABLE_CARD
+	SD_INIT_ERROR_UNUSABLE_CARD,
+	SD_INIT_ERROR_VOLTAGE_SWITCH  /**< Error switching to 1.8V signalling */
 };
 
 /**
  * Initialise the inserted SD card so that it is ready for data
  * transfer with sd_read_blocks(). The card is initialised to 
- * 4-bit data bus width, 25 MHz clock, default speed bus mode.
+ * 4-bit data bus width and the fastest bus speed mode supported by
+ * both it and the host. If both support UHS-I the card is switched to
+ * 1.8V signalling and one of SDR104 (208 MHz, with the EMMC2 base clock 
+ * raised through the mailbox as far as the VideoCore allows, and capped at
+ * the base clock rate), SDR50 (100 MHz), or DDR50 (50 MHz), with the 
+ * sampling clock tuned for SDR104. Otherwise it's left at 3.3V signalling and either 
+ * 50 MHz high speed or 25 MHz default speed bus mode.
  *
- * This should supposedly have an up to 12.5 MB/sec transfer rate, 
- * but currently it's only 7 MB/sec. This is is plenty fast enough already,
- * but the rest of the performance can likely be gained by enabling 
- * and setting up the caches, which is left unimplemented for now.
+ * The card was already identified by the firmware to load this bootloader,
+ * so if SD_WARM_INIT is defined to 1 that card is reused as it was left,
+ * skipping its power up, and only identified again if reusing it fails. A 
+ * reused card stays at 3.3V signalling.
+ *
+ * Default speed should supposedly have an up to 12.5 MB/sec transfer rate 
+ * (high speed 25 MB/sec, and SDR50 50 MB/sec). Reading 
+ * through the DATA register only got 7 MB/sec out of it, the CPU being busy 
+ * copying every word, so if the host controller supports it reads are done
+ * with ADMA2 instead, where the host controller copies into RAM itself.
  */
 enum sd_init_error sd_init(void);
 
+/**
+ * @brief Assert that the VideoCore firmware which loaded this bootloader program set up
+ *	  the MMC controller as expected. Must be called before sd_init_start().
+ *
+ * Signal error with error ERROR_VC_NOT_INIT_MMC if the assertion fails.
+ */
+void sd_assert_vc_init(void);
+/**
+ * @brief Start initialising the SD card as in sd_init() without waiting for the card
+ *	  to power up, which can take up to a second. Initialisation is then continued 
+ *	  with sd_init_poll() until it's done, leaving the CPU free for other work between
+ *	  polls. sd_init() does all of this itself.
+ */
+enum sd_init_error sd_init_start(void);
+/**
+ * @brief Continue initialisation started with sd_init_start(). This returns straight 
+ *	  away while the card is still powering up; once it has, the rest of initialisation 
+ *	  is done before returning.
+ *
+ * @param[out] done_out Whether initialisation is done. Only valid on success.
+ */
+enum sd_init_error sd_init_poll(bool *done_out);
+
 /**
  * @brief Read one or more blocks of size SD_BLKSZ from the SD card into RAM.
  *
@@ -35,6 +71,10 @@ enum sd_init_error sd_init(void);
  *		     are of size SD_BLKSZ)
  * @param nblks Number of blocks to read
  *
+ * A read which fails with a CRC or timeout error is retried from the first block 
+ * that wasn't read, and if such errors keep happening the bus is stepped down to 
+ * a slower bus speed mode, and then to a 1-bit data bus width.
+ *
  * @return Whether the read was successful.
  */
 bool sd_read_blocks(byte_t *ram_dest_addr, uint32_t sd_src_lba, int nblks);
@@ -43,6 +83,32 @@ bool sd_read_blocks(byte_t *ram_dest_addr, uint32_t sd_src_lba, int nblks);
  */
 bool sd_read_bytes(byte_t *ram_dest_addr, uint32_t sd_src_lba, int bytes);
 
+/**
+ * @brief Start reading blocks as in sd_read_blocks() without waiting for the read to 
+ *	  finish, so that the CPU can work on already read data while the read is in 
+ *	  flight. Waits for any read already submitted first.
+ *
+ * The read must be finished with sd_read_wait() before any other SD access, and its
+ * destination in RAM must not be touched until then. Only ADMA2 reads are done in the 
+ * background: without ADMA2 the read is finished by the time this returns.
+ *
+ * @return Whether the read was started successfully.
+ */
+bool sd_read_submit(byte_t *ram_dest_addr, uint32_t sd_src_lba, int nblks);
+/**
+ * @brief Check whether the read started with sd_read_submit() is still in flight, 
+ *	  without blocking.
+ */
+bool sd_read_poll(void);
+/**
+ * @brief Wait for the read started with sd_read_submit() to finish.
+ * @return Whether the read was successful (true if there is no submitted read).
+ */
+bool sd_read_wait(void);
+
+/** @brief Get the capacity of the initialised card in blocks. */
+uint32_t sd_nblks(void);
+
 /**
  * Get the number of blocks required to read a number of bytes.
  * If the number of bytes isn't a multiple of SD_BLKSZ the last block
@@ -51,7 +117,7 @@ bool sd_read_bytes(byte_t *ram_dest_addr, uint32_t sd_src_lba, int bytes);
 int bytes_to_blocks(int bytes);
 
 /**
- * @brief Reset the SD card and host controller to its state at boot.
+ * @brief Reset the SD card, host controller and EMMC2 base clock to their state at boot.
  * @return Whether successful.
  */
 bool sd_reset(void);
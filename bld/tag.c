@@ -6,13 +6,47 @@
 #include "vcmailbox.h"
 #include "error.h"
 #include "debug.h"
+#include "help.h"
+
+/* Responses of the tags which return the ID they were given followed by a value. */
+struct power_state_ret {
+	uint32_t dev_id;
+	struct power_state state;
+};
+
+struct clock_state_ret {
+	uint32_t clk_id;
+	struct clock_state state;
+};
+
+struct clock_rate_ret {
+	uint32_t clk_id;
+	uint32_t rate;
+};
+
+struct gpio_state_ret {
+	uint32_t unused;
+	uint32_t state;
+};
+
+/* Number of clock IDs the VideoCore firmware defines, up to and including the pixel BVB clock. */
+#define NCLOCK_IDS  0xf
+/* Number of GPIO expander pins, see enum gpio_expander_pin. */
+#define NGPIO_EXPANDER_PINS  (GPIO_EXPANDER_SD_PWR_ON+1)
+
+/**
+ * Answers of tags which don't change while the bootloader runs, kept after first
+ * being requested so that later lookups don't need a mailbox round trip.
+ */
+static struct {
+	uint32_t clk_max_rate[NCLOCK_IDS];  /**< 0 until cached. */
+	struct gpio_expander_pin_config gpio_cfg[NGPIO_EXPANDER_PINS];
+	bool gpio_cfg_cached[NGPIO_EXPANDER_PINS];
+} cache;
 
 struct power_state tag_power_get_state(uint32_t dev_id)
 {
-	struct {
-		uint32_t dev_id;
-		struct power_state state;
-	} ret;
+	struct power_state_ret ret;
 	struct tag_request req = { TAG_POWER_GET_STATE, &dev_id, sizeof(dev_id),
 				   &ret, sizeof(ret) };
 	enum vcmailbox_error error = vcmailbox_request_tags(&req, 1);
@@ -28,10 +62,7 @@ struct power_state tag_power_get_state(uint32_t dev_id)
 
 struct clock_state tag_clock_get_state(uint32_t clk_id)
 {
-	struct {
-		uint32_t clk_id;
-		struct clock_state state;
-	} ret;
+	struct clock_state_ret ret;
 	struct tag_request req = { TAG_CLOCK_GET_STATE, &clk_id, sizeof(clk_id),
 				   &ret, sizeof(ret) };
 	enum vcmailbox_error error = vcmailbox_request_tags(&req, 1);
@@ -45,17 +76,54 @@ struct clock_state tag_clock_get_state(uint32_t clk_id)
 }
 
 uint32_t tag_clock_get_rate(uint32_t clk_id)
+{
+	struct clock_rate_ret ret;
+	struct tag_request req = { TAG_CLOCK_GET_RATE, &clk_id, sizeof(clk_id),
+				   &ret, sizeof(ret) };
+	enum vcmailbox_error error = vcmailbox_request_tags(&req, 1);
+
+	if (error != VCMBOX_ERROR_NONE || ret.clk_id != clk_id) {
+		serial_log("Vcmailbox error: clock get rate: %08x %08x",
+			   clk_id, ret.clk_id);
+		signal_error(ERROR_VCMAILBOX);
+	}
+	return ret.rate;
+}
+
+uint32_t tag_clock_get_max_rate(uint32_t clk_id)
+{
+	struct clock_rate_ret ret;
+	struct tag_request req = { TAG_CLOCK_GET_MAX_RATE, &clk_id, sizeof(clk_id),
+				   &ret, sizeof(ret) };
+	enum vcmailbox_error error;
+
+	if (clk_id < NCLOCK_IDS && cache.clk_max_rate[clk_id])
+		return cache.clk_max_rate[clk_id];
+	error = vcmailbox_request_tags(&req, 1);
+	if (error != VCMBOX_ERROR_NONE || ret.clk_id != clk_id) {
+		serial_log("Vcmailbox error: clock get max rate: %08x %08x",
+			   clk_id, ret.clk_id);
+		signal_error(ERROR_VCMAILBOX);
+	}
+	if (clk_id < NCLOCK_IDS)
+		cache.clk_max_rate[clk_id] = ret.rate;
+	return ret.rate;
+}
+
+uint32_t tag_clock_set_rate(uint32_t clk_id, uint32_t rate)
 {
 	struct {
 		uint32_t clk_id;
 		uint32_t rate;
-	} ret;
-	struct tag_request req = { TAG_CLOCK_GET_RATE, &clk_id, sizeof(clk_id),
+		uint32_t skip_setting_turbo;
+	} args = { clk_id, rate, 0 };
+	struct clock_rate_ret ret;
+	struct tag_request req = { TAG_CLOCK_SET_RATE, &args, sizeof(args),
 				   &ret, sizeof(ret) };
 	enum vcmailbox_error error = vcmailbox_request_tags(&req, 1);
 
 	if (error != VCMBOX_ERROR_NONE || ret.clk_id != clk_id) {
-		serial_log("Vcmailbox error: clock get rate: %08x %08x",
+		serial_log("Vcmailbox error: clock set rate: %08x %08x",
 			   clk_id, ret.clk_id);
 		signal_error(ERROR_VCMAILBOX);
 	}
@@ -63,6 +131,53 @@ uint32_t tag_clock_get_rate(uint32_t clk_id)
 }
 
 
+/**
+ * @brief Get a temperature through a tag which takes a temperature ID, where 
+ *	  ID 0 is the only one, the SoC's.
+ */
+static uint32_t tag_temp_request(uint32_t tag_id)
+{
+	uint32_t temp_id = 0;
+	struct {
+		uint32_t temp_id;
+		uint32_t temp;
+	} ret;
+	struct tag_request req = { tag_id, &temp_id, sizeof(temp_id), &ret, sizeof(ret) };
+	enum vcmailbox_error error = vcmailbox_request_tags(&req, 1);
+
+	if (error != VCMBOX_ERROR_NONE || ret.temp_id != temp_id) {
+		serial_log("Vcmailbox error: temperature tag %08x: %08x", tag_id, ret.temp_id);
+		signal_error(ERROR_VCMAILBOX);
+	}
+	return ret.temp;
+}
+
+uint32_t tag_temp_get(void)
+{
+	return tag_temp_request(TAG_TEMP_GET);
+}
+
+uint32_t tag_temp_get_max(void)
+{
+	return tag_temp_request(TAG_TEMP_GET_MAX);
+}
+
+
+uint32_t tag_get_throttled(void)
+{
+	uint32_t flags = 0;
+	struct tag_request req = { TAG_GET_THROTTLED, &flags, sizeof(flags), 
+				   &flags, sizeof(flags) };
+	enum vcmailbox_error error = vcmailbox_request_tags(&req, 1);
+
+	if (error != VCMBOX_ERROR_NONE) {
+		serial_log("Vcmailbox error: get throttled");
+		signal_error(ERROR_VCMAILBOX);
+	}
+	return flags;
+}
+
+
 /* Pin number of the GPIO expander BT_ON pin in the VideoCore device tree. */
 #define GPIO_EXPANDER_VC_PIN_BASE 128
 
@@ -77,10 +192,7 @@ static int convert_pin_to_vc(enum gpio_expander_pin pin)
 
 uint32_t tag_gpio_get_state(uint32_t pin)
 {
-	struct {
-		uint32_t unused;
-		uint32_t state;
-	} ret;
+	struct gpio_state_ret ret;
 	uint32_t vcpin = convert_pin_to_vc(pin);
 	struct tag_request req = { TAG_GPIO_GET_STATE, &vcpin, sizeof(vcpin), 
 				   &ret, sizeof(ret) };
@@ -94,19 +206,41 @@ uint32_t tag_gpio_get_state(uint32_t pin)
 	return ret.state;
 }
 
+void tag_gpio_set_state(uint32_t pin, uint32_t state)
+{
+	struct {
+		uint32_t vcpin;
+		uint32_t state;
+	} args = { convert_pin_to_vc(pin), state };
+	struct gpio_state_ret ret;
+	struct tag_request req = { TAG_GPIO_SET_STATE, &args, sizeof(args), 
+				   &ret, sizeof(ret) };
+	enum vcmailbox_error error = vcmailbox_request_tags(&req, 1);
+
+	if (error != VCMBOX_ERROR_NONE || ret.unused != 0) {
+		serial_log("Vcmailbox error: gpio set state: %08x", ret.unused);
+		signal_error(ERROR_VCMAILBOX);
+	}
+}
+
 struct gpio_expander_pin_config tag_gpio_get_config(uint32_t pin)
 {
 	struct gpio_expander_pin_config cfg;
 	uint32_t vcpin = convert_pin_to_vc(pin);
 	struct tag_request req = { TAG_GPIO_GET_CONFIG, &vcpin, sizeof(vcpin), 
 				   &cfg, sizeof(cfg) };
-	enum vcmailbox_error error = vcmailbox_request_tags(&req, 1);
+	enum vcmailbox_error error;
 
+	if (cache.gpio_cfg_cached[pin])
+		return cache.gpio_cfg[pin];
+	error = vcmailbox_request_tags(&req, 1);
 	/* A non-zero "unused" is an error in the Linux Raspberry Pi 3 expander GPIO driver. */
 	if (error != VCMBOX_ERROR_NONE || cfg.unused != 0) {
 		serial_log("Vcmailbox error: gpio get config: %08x", cfg.unused);
 		signal_error(ERROR_VCMAILBOX);
 	}
+	cache.gpio_cfg[pin] = cfg;
+	cache.gpio_cfg_cached[pin] = true;
 	return cfg;
 }
 
@@ -120,3 +254,79 @@ bool gpio_config_pin_is_active_high(struct gpio_expander_pin_config *cfg)
 	return !cfg->polarity;
 }
 
+
+
+/* Requests and responses of the boot state, kept while its request is in flight. */
+static struct {
+	enum {
+		BOOT_STATE_NOT_REQUESTED,
+		BOOT_STATE_POSTED,
+		BOOT_STATE_FETCHED
+	} status;
+	uint32_t emmc2, core, sd_io_sel, sd_pwr_on;
+	struct clock_state_ret emmc2_state;
+	struct clock_rate_ret emmc2_rate, core_rate;
+	struct gpio_state_ret sd_io_sel_state, sd_pwr_on_state;
+	struct tag_request reqs[7];
+	struct vcmailbox_transaction transaction;
+	struct vc_boot_state state;
+} boot;
+
+void tag_boot_state_post(void)
+{
+	struct tag_request reqs[] = {
+		{ TAG_CLOCK_GET_STATE, &boot.emmc2, sizeof(boot.emmc2), 
+		  &boot.emmc2_state, sizeof(boot.emmc2_state) },
+		{ TAG_CLOCK_GET_RATE, &boot.emmc2, sizeof(boot.emmc2), 
+		  &boot.emmc2_rate, sizeof(boot.emmc2_rate) },
+		{ TAG_CLOCK_GET_RATE, &boot.core, sizeof(boot.core), 
+		  &boot.core_rate, sizeof(boot.core_rate) },
+		{ TAG_GPIO_GET_CONFIG, &boot.sd_io_sel, sizeof(boot.sd_io_sel), 
+		  &boot.state.sd_io_sel_cfg, sizeof(boot.state.sd_io_sel_cfg) },
+		{ TAG_GPIO_GET_STATE, &boot.sd_io_sel, sizeof(boot.sd_io_sel), 
+		  &boot.sd_io_sel_state, sizeof(boot.sd_io_sel_state) },
+		{ TAG_GPIO_GET_CONFIG, &boot.sd_pwr_on, sizeof(boot.sd_pwr_on), 
+		  &boot.state.sd_pwr_on_cfg, sizeof(boot.state.sd_pwr_on_cfg) },
+		{ TAG_GPIO_GET_STATE, &boot.sd_pwr_on, sizeof(boot.sd_pwr_on), 
+		  &boot.sd_pwr_on_state, sizeof(boot.sd_pwr_on_state) }
+	};
+
+	if (boot.status != BOOT_STATE_NOT_REQUESTED)
+		return;
+	boot.emmc2 = CLK_EMMC2;
+	boot.core = CLK_CORE;
+	boot.sd_io_sel = convert_pin_to_vc(GPIO_EXPANDER_VDD_SD_IO_SEL);
+	boot.sd_pwr_on = convert_pin_to_vc(GPIO_EXPANDER_SD_PWR_ON);
+	mcopy(reqs, boot.reqs, sizeof(boot.reqs));
+	vcmailbox_post_tags(&boot.transaction, boot.reqs, array_len(boot.reqs));
+	boot.status = BOOT_STATE_POSTED;
+}
+
+struct vc_boot_state *tag_boot_state(void)
+{
+	enum vcmailbox_error error;
+
+	if (boot.status == BOOT_STATE_FETCHED)
+		return &boot.state;
+	tag_boot_state_post();
+	error = vcmailbox_wait(&boot.transaction);
+	if (error != VCMBOX_ERROR_NONE || boot.emmc2_state.clk_id != boot.emmc2 || 
+	    boot.emmc2_rate.clk_id != boot.emmc2 || boot.core_rate.clk_id != boot.core || 
+	    boot.state.sd_io_sel_cfg.unused || boot.sd_io_sel_state.unused || 
+	    boot.state.sd_pwr_on_cfg.unused || boot.sd_pwr_on_state.unused) {
+		serial_log("Vcmailbox error: boot state");
+		signal_error(ERROR_VCMAILBOX);
+	}
+	boot.state.emmc2_clk = boot.emmc2_state.state;
+	boot.state.emmc2_clk_rate = boot.emmc2_rate.rate;
+	boot.state.core_clk_rate = boot.core_rate.rate;
+	boot.state.sd_io_sel_state = boot.sd_io_sel_state.state;
+	boot.state.sd_pwr_on_state = boot.sd_pwr_on_state.state;
+
+	cache.gpio_cfg[GPIO_EXPANDER_VDD_SD_IO_SEL] = boot.state.sd_io_sel_cfg;
+	cache.gpio_cfg_cached[GPIO_EXPANDER_VDD_SD_IO_SEL] = true;
+	cache.gpio_cfg[GPIO_EXPANDER_SD_PWR_ON] = boot.state.sd_pwr_on_cfg;
+	cache.gpio_cfg_cached[GPIO_EXPANDER_SD_PWR_ON] = true;
+	boot.status = BOOT_STATE_FETCHED;
+	return &boot.state;
+}
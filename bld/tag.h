@@ -8,6 +8,7 @@
 #define TAG_H
 
 #include "type.h"
+#include "bits.h"
 
 enum power_device_id {
 	PWR_DEV_SD = 0x0
@@ -26,6 +27,8 @@ struct power_state tag_power_get_state(uint32_t dev_id);
 
 
 enum clock_id {
+	CLK_UART  = 0x2,  /* PL011 UART. */
+	CLK_ARM   = 0x3,
 	CLK_CORE  = 0x4,  /* VPU. */
 	CLK_EMMC2 = 0xc
 };
@@ -42,6 +45,34 @@ struct clock_state {
 struct clock_state tag_clock_get_state(uint32_t clk_id);
 /** @return Clock rate in Hz. */
 uint32_t tag_clock_get_rate(uint32_t clk_id);
+/** 
+ * @return Max rate the clock can be set to, in Hz. Only requested from the VideoCore 
+ *	   the first time for each clock.
+ */
+uint32_t tag_clock_get_max_rate(uint32_t clk_id);
+/**
+ * @brief Set a clock's rate. The firmware picks the closest rate it supports.
+ * @param rate Rate in Hz
+ * @return The rate the clock was set to, in Hz.
+ */
+uint32_t tag_clock_set_rate(uint32_t clk_id, uint32_t rate);
+
+
+/** @return SoC temperature in thousandths of a degree Celsius. */
+uint32_t tag_temp_get(void);
+/** @return Temperature the firmware starts throttling at, in thousandths of a degree Celsius. */
+uint32_t tag_temp_get_max(void);
+
+/* Throttled state flags, the ones set since boot (sticky) are in bits 19:16. */
+#define THROTTLED_UNDER_VOLTAGE	  BIT(0)
+#define THROTTLED_ARM_FREQ_CAPPED BIT(1)
+#define THROTTLED_THROTTLED	  BIT(2)
+#define THROTTLED_SOFT_TEMP_LIMIT BIT(3)
+/** @brief Current throttled state flags, the bitwise OR of THROTTLED_ flags. */
+#define THROTTLED_NOW		  BITS(3, 0)
+
+/** @return Throttling and under-voltage state flags, see THROTTLED_NOW. */
+uint32_t tag_get_throttled(void);
 
 
 enum gpio_expander_pin {
@@ -63,6 +94,12 @@ enum gpio_expander_pin {
  * @param pin An enum gpio_expander_pin
  */
 uint32_t tag_gpio_get_state(uint32_t pin);
+/**
+ * @brief Set the state of a GPIO expander output pin.
+ * @param pin An enum gpio_expander_pin
+ * @param state 0 to drive the pin low, 1 to drive it high
+ */
+void tag_gpio_set_state(uint32_t pin, uint32_t state);
 
 /**
  * @brief Config for a GPIO expander pin.
@@ -76,11 +113,41 @@ struct gpio_expander_pin_config {
 };
 
 /**
- * @brief Get a GPIO expander pin's config.
+ * @brief Get a GPIO expander pin's config. The config doesn't change, so it's only 
+ *	  requested from the VideoCore the first time.
  * @param pin An enum gpio_expander_pin
  */
 struct gpio_expander_pin_config tag_gpio_get_config(uint32_t pin);
 bool gpio_config_pin_is_output(struct gpio_expander_pin_config *cfg);
 bool gpio_config_pin_is_active_high(struct gpio_expander_pin_config *cfg);
 
+
+/**
+ * @brief The state the VideoCore firmware left the clocks and GPIO expander pins the 
+ *	  bootloader depends on in.
+ */
+struct vc_boot_state {
+	struct clock_state emmc2_clk;
+	uint32_t emmc2_clk_rate;  /**< In Hz */
+	uint32_t core_clk_rate;  /**< In Hz, fixed by config.txt, see uart.h */
+	struct gpio_expander_pin_config sd_io_sel_cfg;  /**< GPIO_EXPANDER_VDD_SD_IO_SEL */
+	uint32_t sd_io_sel_state;
+	struct gpio_expander_pin_config sd_pwr_on_cfg;  /**< GPIO_EXPANDER_SD_PWR_ON */
+	uint32_t sd_pwr_on_state;
+};
+
+/**
+ * @brief Post the request for the boot state to the VideoCore without waiting for the 
+ *	  response, so that tag_boot_state() finds it already answered.
+ */
+void tag_boot_state_post(void);
+/**
+ * @brief Get the state the VideoCore firmware left things in, all requested in a 
+ *	  single mailbox round trip by the first call to this or tag_boot_state_post().
+ *	  Later calls return the same state without requesting it again, so it doesn't 
+ *	  reflect changes made since. The pin configs are also cached for 
+ *	  tag_gpio_get_config().
+ */
+struct vc_boot_state *tag_boot_state(void);
+
 #endif
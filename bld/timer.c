@@ -5,7 +5,7 @@
 #include "timer.h"
 #include "mmio.h"
 #include "type.h"
-#include "gic.h"
+#include "int.h"
 #include "bits.h"
 
 /**
@@ -51,6 +51,35 @@ static struct periph_access timer_access = {
 /** @brief Convert milliseconds to microseconds. */
 #define ms_to_us(ms) ms*COUNTER_CLK_CPMS
 
+/* Counter-timer kernel control register (CNTKCTL) fields. */
+#define CNTKCTL_EVNTEN	    BIT(2)
+#define CNTKCTL_EVNTI_SHIFT 4
+/*
+ * Counter bit whose 0 to 1 transitions generate the event stream events: bit 5 
+ * gives an event every 64 ticks, about every 1.2 microseconds at 54 MHz.
+ */
+#define EVENT_STREAM_BIT    5
+
+/** @return Generic timer counter frequency in Hz, as set up by the ARM stub. */
+static uint32_t cntfrq(void)
+{
+	uint32_t freq;
+
+	__asm__ volatile("mrc p15, 0, %0, c14, c0, 0" : "=r" (freq));
+	return freq;
+}
+
+void timer_init(void)
+{
+	uint32_t cntkctl;
+
+	__asm__ volatile("mrc p15, 0, %0, c14, c1, 0" : "=r" (cntkctl));
+	cntkctl &= ~BITS(7, 4);
+	cntkctl |= CNTKCTL_EVNTEN|EVENT_STREAM_BIT<<CNTKCTL_EVNTI_SHIFT;
+	__asm__ volatile("mcr p15, 0, %0, c14, c1, 0\n\t"
+			 "isb" :: "r" (cntkctl));
+}
+
 static volatile bool queued_timer_irq_serviced;
 
 /**
@@ -87,19 +116,33 @@ void timer_isr(void)
 
 void usleep(int microseconds)
 {
-#if !ENABLE_GIC
-/* Interrupt implementation: */
+	timestamp_t end;
+
+	/*
+	 * Poll when interrupts aren't enabled, e.g. when signalling an error before they're
+	 * enabled or after they're disabled for the kernel.
+	 */
+	if (!interrupts_enabled()) {
+		end = timer_current() + (uint64_t)microseconds*(cntfrq()/1000000);
+		while (timer_current() < end)
+			timer_wait_event();
+		return;
+	}
+	/* 
+	 * Interrupts are masked around the check of the serviced flag so the interrupt
+	 * can't be taken between the check and the wfi, which would leave the core waiting
+	 * for an interrupt that has already happened. A pending interrupt still wakes the
+	 * core from wfi while it's masked, and is taken once unmasked.
+	 */
+	disable_interrupts();
 	timer_queue_irq(microseconds);
 	/* Can only be woken up from a timer IRQ and not a different peripheral. */
-	do {
-		__asm__("wfi");
-	} while (!queued_timer_irq_serviced);
-#else
-/* Polled implementation: */
-	int end_ticks = register_get(&timer_access, CLO)+microseconds;
-	while (register_get(&timer_access, CLO) < end_ticks)
-		;
-#endif
+	while (!queued_timer_irq_serviced) {
+		__asm__ volatile("wfi");
+		enable_interrupts();
+		disable_interrupts();
+	}
+	enable_interrupts();
 }
 
 void sleep(int milliseconds)
@@ -109,17 +152,48 @@ void sleep(int milliseconds)
 
 timestamp_t timer_poll_start(int milliseconds)
 {
-	int current_ticks = register_get(&timer_access, CLO);
-	return current_ticks+ms_to_us(milliseconds);
+	return timer_current() + (uint64_t)milliseconds*(cntfrq()/1000);
 }
 
 bool timer_poll_done(timestamp_t ts)
 {
-	int current_ticks = register_get(&timer_access, CLO);
-	return current_ticks >= ts;
+	return timer_current() >= ts;
 }
 
 timestamp_t timer_current(void)
 {
-	return register_get(&timer_access, CLO);
+	uint32_t lo, hi;
+
+	/* The isb stops the counter being read early, out of order. */
+	__asm__ volatile("isb\n\t"
+			 "mrrc p15, 0, %0, %1, c14" : "=r" (lo), "=r" (hi));
+	return (uint64_t)hi<<32 | lo;
+}
+
+/**
+ * @brief Divide a 64-bit number by a 32-bit one by shifting and subtracting, since
+ *	  there's no compiler runtime library to do 64-bit division.
+ */
+static uint64_t udiv64(uint64_t n, uint32_t d)
+{
+	uint64_t q = 0, r = 0;
+
+	for (int i = 63; i >= 0; --i) {
+		r = r<<1 | (n>>i&1);
+		if (r >= d) {
+			r -= d;
+			q |= (uint64_t)1<<i;
+		}
+	}
+	return q;
+}
+
+uint32_t timer_current_us(void)
+{
+	return udiv64(timer_current(), cntfrq()/1000000);
+}
+
+void timer_wait_event(void)
+{
+	__asm__ volatile("wfe");
 }
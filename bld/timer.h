@@ -12,23 +12,34 @@
  * the AXI/APB, is chosen because it is fixed-frequency - the AXI/APB is not 
  * fixed-frequency, which could inhibit accurate timing.
  * Note the crystal clock is selected by default.
+ *
+ * The system timer is only used to be interrupted when sleeping. Timestamps 
+ * and polled waits use the ARM generic timer's physical counter instead, which
+ * is read from a coprocessor register rather than over the peripheral bus, is
+ * 64 bits wide, and runs at 54 MHz.
  */
 #ifndef TIMER_H
 #define TIMER_H
 
 #include "type.h"
 
+/**
+ * @brief Turn on the generic timer event stream for this core, which periodically 
+ *	  wakes the core from wfe so that polled waits can wait with wfe. 
+ */
+void timer_init(void);
 void timer_isr(void);
 
 /**
  * @defgroup sleep_fns
  * @brief Pause the CPU, putting it in an idle state for a milliseconds/microseconds amount of time.
  *
+ * Sleeps with wfi until the system timer interrupt if interrupts are enabled, otherwise polls.
+ *
  * @warning Do not sleep for a very short microseconds amount of time, e.g. less than 5 microseconds
- *          from testing, because of potential race conditions: either the interrupt won't be triggered or it 
- *          will be triggered before sleeping, resulting in waiting for an interrupt that has already interrupted. 
- *          The issue also seems to arise sometimes when sleeping for ~20 microseconds. To be on the safe side 
- *          use a minimum microseconds value considerably higher than the times mentioned above.
+ *          from testing, because the counter can pass the compare value before it's set, in which case
+ *          the interrupt isn't triggered. To be on the safe side use a minimum microseconds value 
+ *          considerably higher than that.
  * @{
  */
 void usleep(int microseconds);
@@ -41,17 +52,9 @@ void sleep(int milliseconds);
  * @brief Start a non-sleeping timer with timer_poll_start(). Whether the milliseconds amount of time argument
  *	  to timer_poll_start() has elapsed can be checked/polled with timer_poll_done().
  * 
- * @warning The implementation of this only uses the lower 32-bits of the 64-bit free running counter.
- *          Because the system timer clock is 1 MHz, it will take ~71 minutes for the lower 32 bits to go from 0
- *          to its maximum and then restart back at 0. If an overflow timestamp is taken (timestamp here is the 
- *          time at which the milliseconds amount of time argument initially passes), which can happen when the 
- *          pi has been running for almost ~71 minutes, calls to timer_poll_done() will return a false positive
- *          until the lower 32-bits of the counter itself overflows. 
- *          Conclusion: these functions are safe to use under the assumption that the low 32-bits are reset to 0 
- *          at power on (the BCM2711 datasheet says they are), and that the pi hasn't been running for almost ~71 
- *          minutes (which is very unlikely since this is a bootloader).
+ * Timestamps are generic timer counter ticks. The counter is 64 bits so doesn't wrap in practice.
  */
-typedef uint32_t timestamp_t;
+typedef uint64_t timestamp_t;
 /** @{ */
 timestamp_t timer_poll_start(int milliseconds);
 bool timer_poll_done(timestamp_t ts);
@@ -61,5 +64,13 @@ bool timer_poll_done(timestamp_t ts);
  * @brief Get a timestamp of the current time.
  */
 timestamp_t timer_current(void);
+/** @brief Get the current time in microseconds, truncated to 32 bits. */
+uint32_t timer_current_us(void);
+
+/** 
+ * @brief Wait for an event, or at the latest the next event stream event. For polled 
+ *	  waits, in place of spinning. 
+ */
+void timer_wait_event(void);
 
 #endif
@@ -10,6 +10,8 @@
 #include "gpio.h"
 #include "bits.h"
 
+#if !UART_PL011
+
 enum uart_register {
 	AUX_ENABLES,
 	AUX_MU_IO_REG,
@@ -52,8 +54,10 @@ static void uart_set_baudrate(int baudrate)
 	 * The VPU clock is used because it's the clock listed for the mini UART / 
 	 * auxiliary peripherals in the BCM2711 RPI 4 B device tree. This is also the clock
 	 * that was fixed with config.txt entries core_freq[_min] explained at the top of uart.h.
+	 * Its rate is requested along with the rest of the state the boot needs, in one
+	 * mailbox round trip.
 	 */
-	int system_clk_freq = tag_clock_get_rate(CLK_CORE);
+	int system_clk_freq = tag_boot_state()->core_clk_rate;
 	int oversampling = 8;
 	int baudrate_reg = system_clk_freq/(baudrate*oversampling) - 1;
 	/* 
@@ -76,7 +80,7 @@ void uart_init(void)
 	register_disable_bits(&uart_access, AUX_MU_CNTL_REG, AUX_MU_CNTL_REG_RX_EN);
 
 	/* Set parameters listed in the comment at this function's prototype. */
-	uart_set_baudrate(115200);
+	uart_set_baudrate(UART_BAUDRATE);
 	/* Set 8 data bits. */
 	register_set(&uart_access, AUX_MU_LCR_REG, AUX_MU_LCR_REG_DATA_SIZE);
 	/* 
@@ -94,6 +98,16 @@ static bool uart_lsr_transmitter_not_empty(void)
 	return !(register_get(&uart_access, AUX_MU_LSR_REG)&AUX_MU_LSR_REG_TX_EMPTY);
 }
 
+int uart_transmit_nonblock(void *data, int n)
+{
+	byte_t *byte = data;
+	int i;
+
+	for (i = 0; i < n && !uart_lsr_transmitter_not_empty(); ++i)
+		register_set(&uart_access, AUX_MU_IO_REG, byte[i]&AUX_MU_IO_REG_TX_DATA);
+	return i;
+}
+
 void uart_transmit(void *data, int n)
 {
 	byte_t *byte = data;
@@ -105,3 +119,4 @@ void uart_transmit(void *data, int n)
 	}
 }
 
+#endif
@@ -2,7 +2,8 @@
  * Copyright (C) 2023 Petar Turukalo
  * SPDX-License-Identifier: GPL-2.0
  *
- * Access to the mini UART.
+ * Access to a UART transmitting on GPIO pin 14: either the mini UART (UART1),
+ * implemented in uart.c, or the PL011 (UART0), implemented in uart_pl011.c.
  *
  * To use the mini UART clock_freq=250 and clock_freq_min=250 
  * must be set in config.txt to fix the VPU/core clock to 250 MHz.
@@ -14,16 +15,30 @@
  *
  * Note setting enable_uart=1 is NOT required in config.txt, and is actually
  * redundant here because uart_init() is enabling it.
+ *
+ * The PL011 has its own clock and a fractional baud rate divisor, so doesn't 
+ * need the core clock fixed, and goes to much higher baud rates. To hand the 
+ * PL011 on GPIO pin 14 to the kernel, dtoverlay=disable-bt (or miniuart-bt) 
+ * should be set in config.txt, since the PL011 is otherwise used for Bluetooth.
  */
 #ifndef UART_H
 #define UART_H
 
+/* Whether to use the PL011 instead of the mini UART. Set by the Makefile's uart variable. */
+#ifndef UART_PL011
+#define UART_PL011 0
+#endif
+/* Set by the Makefile's baudrate variable. */
+#ifndef UART_BAUDRATE
+#define UART_BAUDRATE 115200
+#endif
+
 /**
- * Initialise the mini UART for transmission on GPIO pin 14.
+ * Initialise the UART for transmission on GPIO pin 14.
  *
- * The UART is initialised with the following parameters (115,200 8N1), 
- * which the receiver is expected to match:
- * - 115,200 baudrate
+ * The UART is initialised with the following parameters (115,200 8N1 by
+ * default), which the receiver is expected to match:
+ * - UART_BAUDRATE baudrate
  * - 8 data bits
  * - no parity
  * - 1 stop bits
@@ -32,10 +47,16 @@
 void uart_init(void);
 
 /**
- * @brief Transmit n bytes of data over the mini UART.
+ * @brief Transmit n bytes of data over the UART.
  *
  * A single call to uart_init() must have been made before any call to this.
  */
 void uart_transmit(void *data, int n);
+/**
+ * @brief Transmit as many of n bytes of data as the transmit FIFO has room for, 
+ *	  without waiting.
+ * @return The number of bytes transmitted.
+ */
+int uart_transmit_nonblock(void *data, int n);
 
 #endif
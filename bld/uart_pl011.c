@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2023 Petar Turukalo
+ * SPDX-License-Identifier: GPL-2.0
+ *
+ * The PL011 UART (UART0) implementation of uart.h, from the ARM PrimeCell UART 
+ * (PL011) Technical Reference Manual and section '11. UART' of the BCM2711 
+ * datasheet.
+ */
+#include "uart.h"
+#include "mmio.h"
+#include "tag.h"
+#include "gpio.h"
+#include "help.h"
+#include "bits.h"
+
+#if UART_PL011
+
+enum uart_register {
+	DR,    /* Data. */
+	FR,    /* Flag. */
+	IBRD,  /* Integer baud rate divisor. */
+	FBRD,  /* Fractional baud rate divisor. */
+	LCRH,  /* Line control. */
+	CR,    /* Control. */
+	IMSC,  /* Interrupt mask set/clear. */
+	ICR    /* Interrupt clear. */
+};
+
+static struct periph_access uart_access = {
+	.periph_base_off = 0x2201000,
+	.register_offsets = {
+		[DR]   = 0x00,
+		[FR]   = 0x18,
+		[IBRD] = 0x24,
+		[FBRD] = 0x28,
+		[LCRH] = 0x2c,
+		[CR]   = 0x30,
+		[IMSC] = 0x38,
+		[ICR]  = 0x44
+	}
+};
+
+#define DR_DATA	    BITS(7, 0)
+
+#define FR_BUSY	    BIT(3)  /* Transmitting, or the transmit FIFO isn't empty. */
+#define FR_TXFF	    BIT(5)  /* Transmit FIFO full. */
+
+#define FBRD_SHIFT  6  /* Fractional divisor is in 64ths. */
+#define FBRD_FRAC   BITS(5, 0)
+
+#define LCRH_FEN    BIT(4)  /* Enable FIFOs. */
+#define LCRH_WLEN_8 BITS(6, 5)  /* 8 data bits. */
+
+#define CR_UARTEN   BIT(0)
+#define CR_TXE	    BIT(8)  /* Transmit enable. */
+
+#define ICR_ALL	    BITS(10, 0)
+
+/* The UART clock is divided by 16 times the baud rate divisor, which must be at least 1. */
+#define UART_CLK_OVERSAMPLING 16
+
+static bool uart_busy(void)
+{
+	return register_get(&uart_access, FR)&FR_BUSY;
+}
+
+/** @return The UART clock rate in Hz, raised if it's too slow for the baud rate. */
+static uint32_t uart_clock_rate(int baudrate)
+{
+	uint32_t rate = tag_clock_get_rate(CLK_UART);
+
+	if (rate < UART_CLK_OVERSAMPLING*baudrate)
+		rate = tag_clock_set_rate(CLK_UART, UART_CLK_OVERSAMPLING*baudrate);
+	return rate;
+}
+
+static void uart_set_baudrate(int baudrate)
+{
+	/*
+	 * The divisor is the UART clock rate over 16 times the baud rate, with the 
+	 * fraction in 64ths. So in 64ths it's 4 times the clock rate over the baud 
+	 * rate, rounded to the nearest.
+	 */
+	uint32_t div = (4*uart_clock_rate(baudrate) + baudrate/2)/baudrate;
+
+	register_set(&uart_access, IBRD, div>>FBRD_SHIFT);
+	register_set(&uart_access, FBRD, div&FBRD_FRAC);
+}
+
+void uart_init(void)
+{
+	/* Let anything the firmware was transmitting finish before disabling. */
+	while_cond_timeout_infinite(uart_busy, 20);
+	register_set(&uart_access, CR, 0);
+	/* Polled, so no interrupts. */
+	register_set(&uart_access, IMSC, 0);
+	register_set(&uart_access, ICR, ICR_ALL);
+
+	/* Setting the pin to alt function 0 selects it as TXD0. */
+	gpio_pin_select_op(GPIO_PIN_TXD0, GPIO_OP_ALT_FN_0);
+	uart_set_baudrate(UART_BAUDRATE);
+	/* 
+	 * 8 data bits, no parity and 1 stop bit, with the FIFOs on. Writing this is
+	 * also what latches the divisors written above. 
+	 */
+	register_set(&uart_access, LCRH, LCRH_WLEN_8|LCRH_FEN);
+	register_set(&uart_access, CR, CR_UARTEN|CR_TXE);
+}
+
+static bool uart_tx_fifo_full(void)
+{
+	return register_get(&uart_access, FR)&FR_TXFF;
+}
+
+int uart_transmit_nonblock(void *data, int n)
+{
+	byte_t *byte = data;
+	int i;
+
+	for (i = 0; i < n && !uart_tx_fifo_full(); ++i)
+		register_set(&uart_access, DR, byte[i]&DR_DATA);
+	return i;
+}
+
+void uart_transmit(void *data, int n)
+{
+	byte_t *byte = data;
+
+	for (; n--; ++byte) {
+		while_cond_timeout_infinite(uart_tx_fifo_full, 1);
+		register_set(&uart_access, DR, (*byte)&DR_DATA);
+	}
+}
+
+#endif
@@ -8,6 +8,8 @@
 #include "heap.h"
 #include "debug.h"
 #include "bits.h"
+#include "mmu.h"
+#include "error.h"
 
 enum vcmailbox_register {
 	MBOX0_READ,
@@ -194,20 +196,34 @@ static int build_tag(struct tag *tag, struct tag_request *req)
 }
 
 /**
- * Build up a property buffer on the heap and return the address to it.
- * The heap is used because the property buffer and tags are variable size 
- * dependent on which and how many tags are selected.
+ * @return The size in bytes of the property buffer build_property_buffer() builds 
+ *	   for the tags, at most.
  */
-static struct property_buffer *build_property_buffer(struct tag_request *tag_requests, int n)
+static int property_buffer_size(struct tag_request *tag_requests, int n)
+{
+	int sz = sizeof(struct property_buffer);
+
+	for (int i = 0; i < n; ++i) {
+		sz += sizeof(struct tag) + max(tag_requests[i].args_sz, tag_requests[i].ret_sz);
+		/* 32-bit align. */
+		sz = (int)align_address((void *)sz, 4);
+	}
+	/* Zeroed end tag, and 16-byte aligning the end. */
+	return (int)align_address((void *)(sz+sizeof(uint32_t)), 16);
+}
+
+/**
+ * Build up a property buffer in a buffer of at least property_buffer_size() bytes.
+ * The VideoCore only needs the buffer 16-byte aligned, but as it doesn't go through
+ * the ARM's caches the buffer mustn't share a cache line with anything else either.
+ */
+static void build_property_buffer(struct property_buffer *prop, 
+				  struct tag_request *tag_requests, int n)
 {
-	struct property_buffer *prop;  
 	/* Used to build up the property buffer. Points to the next available address. */
 	byte_t *prop_end;  
 	struct tag_request *req;
 
-	prop = heap_get_base_address();
-	prop = align_address(prop, 16);
-
 	prop->request_code = 0;
 	prop_end = (byte_t *)&prop->tags;
 	/* Build tags. */
@@ -221,7 +237,6 @@ static struct property_buffer *build_property_buffer(struct tag_request *tag_req
 
 	prop_end = align_address(prop_end, 16);
 	prop->bufsz = prop_end - (byte_t *)prop;
-	return prop;
 }
 
 /**
@@ -269,21 +284,30 @@ static enum vcmailbox_error return_tag_responses(struct property_buffer *prop,
 	return VCMBOX_ERROR_NONE;
 }
 
-enum vcmailbox_error vcmailbox_request_tags(struct tag_request *tag_requests, int n)
+static void send_property_buffer(struct property_buffer *prop)
 {
-	struct property_buffer *send_prop, *recv_prop;
-	uint32_t recv_msg;
+	/* The VideoCore reads and writes the buffer in RAM, not through the ARM's caches. */
+	dcache_clean_range(prop, prop->bufsz);
+	vcmailbox_write_message((uint32_t)prop, CHANNEL_PROPERTY);
+}
 
-	send_prop = build_property_buffer(tag_requests, n);
+/**
+ * @brief Validate the response message to a sent property buffer, and copy the tag 
+ *	  responses out of it.
+ */
+static enum vcmailbox_error receive_property_buffer(struct property_buffer *send_prop, 
+						    uint32_t recv_msg,
+						    struct tag_request *tag_requests, int n)
+{
+	struct property_buffer *recv_prop;
 
-	vcmailbox_write_message((uint32_t)send_prop, CHANNEL_PROPERTY);
-	recv_msg = vcmailbox_read_message();
 	if (recv_msg&CHANNEL_BITS != CHANNEL_PROPERTY) {
 		serial_log("Vcmailbox error: sent message on channel %u but received "
 			   "message on channel %u", CHANNEL_PROPERTY, recv_msg&CHANNEL_BITS);
 		return VCMBOX_ERROR_RECEIVE_WRONG_CHANNEL;
 	}
 	recv_prop = (struct property_buffer *)(recv_msg&(~CHANNEL_BITS));
+	dcache_invalidate_range(send_prop, send_prop->bufsz);
 
 	if (recv_prop != send_prop) {
 		serial_log("Vcmailbox error: address of sent property %08x doesn't match address "
@@ -302,3 +326,75 @@ enum vcmailbox_error vcmailbox_request_tags(struct tag_request *tag_requests, in
 	return return_tag_responses(recv_prop, tag_requests, n);
 }
 
+/*
+ * Size of the buffer transactions are posted in. Transactions can't use the heap like
+ * vcmailbox_request_tags() does since the heap can be allocated from while they're in
+ * flight. A multiple of HEAP_ALIGN_DMA so it doesn't share a cache line.
+ */
+#define TRANSACTION_PROP_BUFSZ 256
+
+static byte_t transaction_prop_buf[TRANSACTION_PROP_BUFSZ] __attribute__((aligned(HEAP_ALIGN_DMA)));
+/* Transaction whose property buffer the VideoCore is handling, if any. */
+static struct vcmailbox_transaction *in_flight;
+
+void vcmailbox_post_tags(struct vcmailbox_transaction *transaction,
+			 struct tag_request *tag_requests, int n)
+{
+	struct property_buffer *prop = (struct property_buffer *)transaction_prop_buf;
+
+	/* Responses come back in the order sent, and there's only the one buffer. */
+	if (in_flight)
+		vcmailbox_wait(in_flight);
+	if (property_buffer_size(tag_requests, n) > TRANSACTION_PROP_BUFSZ) {
+		serial_log("Vcmailbox error: %u tags too big to post", n);
+		signal_error(ERROR_VCMAILBOX);
+	}
+	transaction->tag_requests = tag_requests;
+	transaction->n = n;
+	transaction->done = false;
+	build_property_buffer(prop, tag_requests, n);
+	send_property_buffer(prop);
+	in_flight = transaction;
+}
+
+bool vcmailbox_poll(struct vcmailbox_transaction *transaction)
+{
+	if (transaction->done)
+		return true;
+	if (mbox0_status_empty_flag_set())
+		return false;
+	transaction->error = receive_property_buffer(
+		(struct property_buffer *)transaction_prop_buf,
+		register_get(&vcmailbox_access, MBOX0_READ), 
+		transaction->tag_requests, transaction->n);
+	transaction->done = true;
+	in_flight = NULL;
+	return true;
+}
+
+enum vcmailbox_error vcmailbox_wait(struct vcmailbox_transaction *transaction)
+{
+	if (!transaction->done) {
+		while_cond_timeout_infinite(mbox0_status_empty_flag_set, 200);
+		vcmailbox_poll(transaction);
+	}
+	return transaction->error;
+}
+
+enum vcmailbox_error vcmailbox_request_tags(struct tag_request *tag_requests, int n)
+{
+	/* The property buffer is only needed for the one request. */
+	heap_mark_t mark = heap_mark();
+	struct property_buffer *prop;
+	enum vcmailbox_error error;
+
+	if (in_flight)
+		vcmailbox_wait(in_flight);
+	prop = heap_alloc((uint32_t)align_address((void *)property_buffer_size(tag_requests, n), 
+						  HEAP_ALIGN_DMA), HEAP_ALIGN_DMA);
+	build_property_buffer(prop, tag_requests, n);
+	send_property_buffer(prop);
+	error = receive_property_buffer(prop, vcmailbox_read_message(), tag_requests, n);
+	heap_free_to_mark(mark);
+	return error;
+}
@@ -15,8 +15,14 @@ enum tag_id {
 	TAG_POWER_GET_STATE     = 0x00020001,
 	TAG_CLOCK_GET_STATE     = 0x00030001,
 	TAG_CLOCK_GET_RATE      = 0x00030002,
+	TAG_CLOCK_GET_MAX_RATE  = 0x00030004,
+	TAG_CLOCK_SET_RATE      = 0x00038002,
+	TAG_TEMP_GET            = 0x00030006,  /**< Get SoC temperature. */
+	TAG_TEMP_GET_MAX        = 0x0003000a,  /**< Get temperature the firmware throttles at. */
 	TAG_GPIO_GET_STATE      = 0x00030041,  /**< Get GPIO expander pin state. */
-	TAG_GPIO_GET_CONFIG     = 0x00030043   /**< Get GPIO expander pin config. */
+	TAG_GPIO_GET_CONFIG     = 0x00030043,  /**< Get GPIO expander pin config. */
+	TAG_GET_THROTTLED       = 0x00030046,  /**< Get throttling and under-voltage state. */
+	TAG_GPIO_SET_STATE      = 0x00038041   /**< Set GPIO expander pin state. */
 };
 
 enum vcmailbox_error {
@@ -59,4 +65,39 @@ struct tag_request {
  */
 enum vcmailbox_error vcmailbox_request_tags(struct tag_request *tag_requests, int n);
 
+
+/**
+ * @brief A request for tags posted to the VideoCore with vcmailbox_post_tags(), 
+ *	  whose response is collected later with vcmailbox_poll() or vcmailbox_wait().
+ */
+struct vcmailbox_transaction {
+	struct tag_request *tag_requests;
+	int n;
+	bool done;  /**< Whether the response has been collected */
+	enum vcmailbox_error error;  /**< Error collecting the response, once done */
+};
+
+/**
+ * @brief Post a request for tags to the VideoCore without waiting for its response,
+ *	  so the ARM can get on with something else while the VideoCore handles it.
+ *
+ * @param transaction Handle to collect the response with
+ *
+ * The tag requests and their args and ret buffers must stay valid until the response
+ * has been collected. Only one transaction is in flight at a time: posting another or
+ * calling vcmailbox_request_tags() first waits for the one in flight.
+ *
+ * Signal error ERROR_VCMAILBOX if the tags don't fit in the buffer used to post them.
+ */
+void vcmailbox_post_tags(struct vcmailbox_transaction *transaction,
+			 struct tag_request *tag_requests, int n);
+/**
+ * @brief Collect the response to a transaction if the VideoCore has sent it, 
+ *	  without waiting.
+ * @return Whether the transaction is done, in which case its error field is set.
+ */
+bool vcmailbox_poll(struct vcmailbox_transaction *transaction);
+/** @brief Wait for and collect the response to a transaction. */
+enum vcmailbox_error vcmailbox_wait(struct vcmailbox_transaction *transaction);
+
 #endif
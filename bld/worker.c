@@ -0,0 +1,265 @@
+/*
+ * Copyright (C) 2023 Petar Turukalo
+ * SPDX-License-Identifier: GPL-2.0
+ */
+#include "worker.h"
+#include "mmio.h"
+#include "mmu.h"
+#include "help.h"
+#include "debug.h"
+#include "addrmap.h"
+#include "bits.h"
+
+#define NCORES 4
+/* Max jobs queued on a single core's deque. */
+#define DEQUE_LEN 64
+/* Cache writeback granule: at least the data cache line size. */
+#define CWG 64
+
+enum arm_local_register {
+	CORE1_MBOX3_SET,
+	CORE2_MBOX3_SET,
+	CORE3_MBOX3_SET
+};
+
+static struct periph_access arm_local_access = {
+	.periph_base_off = 0x3800000,
+	.register_offsets = {
+		[CORE1_MBOX3_SET] = 0x9c,
+		[CORE2_MBOX3_SET] = 0xac,
+		[CORE3_MBOX3_SET] = 0xbc
+	}
+};
+
+/* Multiprocessor affinity register: the number of the core within the cluster. */
+#define MPIDR_CPU_ID BITS(1, 0)
+
+/* Assembly labels. */
+extern void secondary_entry(void);
+extern void park_spin(void);
+extern void park_spin_pool_end(void);
+
+struct job {
+	job_fn fn;
+	void *arg;
+};
+
+/**
+ * @brief A core's jobs. Jobs are between top (inclusive) and bottom (exclusive),
+ *	  with both only ever incrementing and indexing into the ring modulo DEQUE_LEN.
+ */
+struct job_deque {
+	uint32_t lock;
+	uint32_t top;
+	uint32_t bottom;
+	struct job jobs[DEQUE_LEN];
+} __attribute__((aligned(CWG)));
+
+static struct job_deque deques[NCORES];
+/* Number of jobs submitted but not yet finished. */
+static uint32_t npending;
+static bool parking;
+static bool started;
+
+/**
+ * @brief Set by each secondary core once it has written back its caches while 
+ *	  parking. Written with the MMU off, so it has a cache line to itself which 
+ *	  the primary core only ever invalidates, never writes back over it.
+ */
+static struct {
+	volatile uint32_t core[NCORES];
+} __attribute__((aligned(CWG))) parked;
+
+static int core_id(void)
+{
+	uint32_t mpidr;
+
+	__asm__ volatile("mrc p15, 0, %0, c0, c0, 5" : "=r" (mpidr));
+	return mpidr&MPIDR_CPU_ID;
+}
+
+static void wait_for_event(void)
+{
+	__asm__ volatile("wfe");
+}
+
+static void send_event(void)
+{
+	__asm__ volatile("dsb\n\t"
+			 "sev");
+}
+
+static void spin_lock(uint32_t *lock)
+{
+	while (__atomic_exchange_n(lock, 1, __ATOMIC_ACQUIRE))
+		wait_for_event();
+}
+
+static void spin_unlock(uint32_t *lock)
+{
+	__atomic_store_n(lock, 0, __ATOMIC_RELEASE);
+	send_event();
+}
+
+/** @return Whether there was room on the deque for the job. */
+static bool deque_push_bottom(struct job_deque *dq, struct job *job)
+{
+	bool pushed = false;
+
+	spin_lock(&dq->lock);
+	if (dq->bottom-dq->top < DEQUE_LEN) {
+		dq->jobs[dq->bottom++%DEQUE_LEN] = *job;
+		pushed = true;
+	}
+	spin_unlock(&dq->lock);
+	return pushed;
+}
+
+/** @brief Take the most recently pushed job, the one most likely still in cache. */
+static bool deque_pop_bottom(struct job_deque *dq, struct job *job_out)
+{
+	bool popped = false;
+
+	spin_lock(&dq->lock);
+	if (dq->bottom != dq->top) {
+		*job_out = dq->jobs[--dq->bottom%DEQUE_LEN];
+		popped = true;
+	}
+	spin_unlock(&dq->lock);
+	return popped;
+}
+
+/** @brief Steal the oldest job, the one furthest from what the owner is working on. */
+static bool deque_steal_top(struct job_deque *dq, struct job *job_out)
+{
+	bool stolen = false;
+
+	spin_lock(&dq->lock);
+	if (dq->bottom != dq->top) {
+		*job_out = dq->jobs[dq->top++%DEQUE_LEN];
+		stolen = true;
+	}
+	spin_unlock(&dq->lock);
+	return stolen;
+}
+
+/**
+ * @brief Run one job, from this core's own deque if it has any, otherwise stolen 
+ *	  from another core's.
+ * @return Whether there was a job to run.
+ */
+static bool run_one_job(int core)
+{
+	struct job job;
+	int i;
+
+	if (!deque_pop_bottom(&deques[core], &job)) {
+		for (i = 1; i < NCORES; ++i) {
+			if (deque_steal_top(&deques[(core+i)%NCORES], &job))
+				break;
+		}
+		if (i == NCORES)
+			return false;
+	}
+	job.fn(job.arg);
+	__atomic_sub_fetch(&npending, 1, __ATOMIC_RELEASE);
+	/* Wake anyone waiting in workers_wait(). */
+	send_event();
+	return true;
+}
+
+/** @brief Park this secondary core. Doesn't return. */
+static void park(int core)
+{
+	__asm__ volatile("mov r0, %0\n\t"
+			 "hvc #1"  /* HVC_PARK_SECONDARY, to _park_secondary. */
+			 : 
+			 : "r" (&parked.core[core])
+			 : "r0");
+}
+
+/**
+ * @brief Entry point to the C code for a secondary core, branched to from 
+ *	  secondary_entry in entry.S.
+ */
+void worker_entry(int core)
+{
+	mmu_enable_secondary();
+
+	for (;;) {
+		if (run_one_job(core))
+			continue;
+		if (__atomic_load_n(&parking, __ATOMIC_ACQUIRE))
+			park(core);
+		/* Woken by the event sent once a job is pushed, or parking is asked for. */
+		wait_for_event();
+	}
+}
+
+void workers_start(void)
+{
+	int core;
+
+	mzero(&parked, sizeof(parked));
+	/* The parked cores write this with the MMU off, straight to RAM. */
+	dcache_clean_invalidate_range(&parked, sizeof(parked));
+
+	/* 
+	 * Give each core the entry address in the mailbox its ARM stub spin loop waits
+	 * on. The write barrier in register_set() makes sure everything written so far is
+	 * visible to it before it's released.
+	 */
+	for (core = 1; core < NCORES; ++core) {
+		register_set(&arm_local_access, CORE1_MBOX3_SET+core-1, 
+			     (uint32_t)secondary_entry);
+	}
+	send_event();
+	started = true;
+	serial_log("Started %u secondary cores as workers", NCORES-1);
+}
+
+void worker_submit(job_fn fn, void *arg)
+{
+	struct job job = { fn, arg };
+
+	__atomic_add_fetch(&npending, 1, __ATOMIC_RELAXED);
+	if (!deque_push_bottom(&deques[core_id()], &job)) {
+		fn(arg);
+		__atomic_sub_fetch(&npending, 1, __ATOMIC_RELEASE);
+	}
+}
+
+void workers_wait(void)
+{
+	int core = core_id();
+
+	while (__atomic_load_n(&npending, __ATOMIC_ACQUIRE)) {
+		if (!run_one_job(core))
+			wait_for_event();
+	}
+}
+
+void workers_park(void)
+{
+	int core;
+
+	workers_wait();
+	if (!started)
+		return;
+	/* 
+	 * Copy the spin loop somewhere the kernel won't overwrite, and write it back
+	 * to RAM for the cores to fetch with their caches off.
+	 */
+	mcopy(park_spin, (byte_t *)PARK_RAM_ADDR, park_spin_pool_end-park_spin);
+	dcache_clean_range((byte_t *)PARK_RAM_ADDR, park_spin_pool_end-park_spin);
+
+	__atomic_store_n(&parking, true, __ATOMIC_RELEASE);
+	send_event();
+	for (core = 1; core < NCORES; ++core) {
+		do {
+			dcache_invalidate_range(&parked, sizeof(parked));
+		} while (!parked.core[core]);
+	}
+	started = false;
+	serial_log("Parked secondary cores");
+}
@@ -0,0 +1,45 @@
+/*
+ * Copyright (C) 2023 Petar Turukalo
+ * SPDX-License-Identifier: GPL-2.0
+ *
+ * Worker pool of the three secondary cores, which would otherwise sit idle
+ * in the ARM stub until the kernel's SMP code releases them. Jobs are queued
+ * on per-core deques: a core pushes and pops its own jobs at the bottom of
+ * its deque, and a core with nothing to do steals from the top of another's.
+ *
+ * Jobs run in parallel on any core, so must only touch memory, and memory 
+ * that no other job is touching: the UART, SD, and mailbox drivers aren't 
+ * safe to use from more than one core.
+ */
+#ifndef WORKER_H
+#define WORKER_H
+
+#include "type.h"
+
+typedef void (*job_fn)(void *arg);
+
+/**
+ * @brief Release the secondary cores from the ARM stub to run queued jobs. 
+ *	  Requires the primary core's MMU already be enabled with mmu_enable().
+ */
+void workers_start(void);
+
+/**
+ * @brief Queue a job to be run by any core, including this one while it waits in 
+ *	  workers_wait(). If the queue is full the job is run straight away instead.
+ */
+void worker_submit(job_fn fn, void *arg);
+
+/**
+ * @brief Wait for all submitted jobs to finish, helping to run them meanwhile.
+ */
+void workers_wait(void);
+
+/**
+ * @brief Return the secondary cores to the ARM stub's state: in hypervisor mode 
+ *	  with MMU and caches off, spinning waiting on their ARM mailbox 3, so that
+ *	  the kernel's SMP code can still start them. Waits for all jobs first.
+ */
+void workers_park(void);
+
+#endif
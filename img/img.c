@@ -11,18 +11,24 @@
 #include <errno.h>
 #include <sys/stat.h>
 #include <stdint.h>
+#include <pthread.h>
 #include "img.h"
+#include "lz4.h"
+#include "../bld/addrmap.h"
 
 #define RDWR_SZ 4096
 
 static void print_usage(void)
 {
-	printf("Usage: 'imager <part> <kern> <dtb>' where <part> is the block\n"
+	printf("Usage: 'imager [-z] <part> <kern> <dtb>' where <part> is the block\n"
 	       "device partition for a MBR primary partition, e.g. /dev/sdc2, and\n"
 	       "is where the remaining arguments will be stored. <kern> is the\n"
 	       "(compressed) 32-bit Linux kernel ARM zImage to boot, and <dtb> is\n"
 	       "the device tree blob that will be passed to the kernel.\n"
 	       "\n"
+	       "With -z or --lz4 each file is stored LZ4 compressed, if that makes it\n"
+	       "smaller, so that the bootloader reads less from the SD card.\n"
+	       "\n"
 	       "Use arg -h or --help to print this message again.\n");
 }
 
@@ -105,52 +111,204 @@ static int round_up_multiple(int n, int m)
 }
 
 /**
- * @brief Append an item to the image.
+ * @brief Append an item to the image and add its entry to the table of contents.
  *
  * @param img Dynamically allocated address of image
+ * @param load_addr Address in RAM the bootloader loads the item's data to
+ * @param rawsz Size of the data once loaded, see toc_entry::rawsz
+ * @param flags Enum item_flags, how the data is stored
  *
  * Uses realloc() to get new space for the item, so the return is the (potentially) 
  * new start address of the image. Return NULL on error.
  */
-static struct image *image_append_item(struct image *img, enum item_id id, int datasz, void *data)
+static struct image_v3 *image_append_item(struct image_v3 *img, enum item_id id, 
+					  uint32_t load_addr, int datasz, void *data, 
+					  int rawsz, uint32_t flags)
 {
-	struct item *item;
-	/* Pad the item to ensure it's aligned to SD_BLKSZ. */
-	int datasz_after_pad = round_up_multiple(sizeof(struct item)+datasz, SD_BLKSZ)
-			       - sizeof(struct item);
+	struct toc_entry *entry;
+	/* Pad the item's data to ensure the next item starts at the start of a block. */
+	int datasz_after_pad = round_up_multiple(datasz, SD_BLKSZ);
 
-	img = realloc(img, img->imgsz+(sizeof(struct item)+datasz_after_pad));
+	if (img->nentries == IMG_TOC_NENTRIES) {
+		fprintf(stderr, "Error: too many items for the table of contents\n");
+		return NULL;
+	}
+	img = realloc(img, img->imgsz+datasz_after_pad);
 	if (!img) {
 		fprintf(stderr, "Error allocating memory: %s\n", strerror(errno));
 		return NULL;
 	}
-	/* Create a new item at the current end of the image. */
-	item = (struct item *)((char *)img+img->imgsz);
-	item->id = id;
-	item->datasz = datasz_after_pad;
-	if (datasz) 
-		memcpy(&item->data, data, datasz);
+	entry = &img->toc[img->nentries++];
+	entry->id = id;
+	entry->lba = img->imgsz/SD_BLKSZ;
+	entry->datasz = datasz;
+	entry->rawsz = rawsz;
+	entry->load_addr = load_addr;
+	entry->flags = flags;
+	/* Copy the data to the current end of the image. */
+	memcpy((char *)img+img->imgsz, data, datasz);
+	memset((char *)img+img->imgsz+datasz, 0, datasz_after_pad-datasz);
 
 	/* Update end of image to include new item. */
-	img->imgsz += sizeof(struct item)+datasz_after_pad;
+	img->imgsz += datasz_after_pad;
 
 	return img;
 }
 
+/**
+ * @brief A chunk of an item to compress.
+ *
+ * @var chunk_job::compsz
+ * Size of the compressed chunk written to comp.
+ */
+struct chunk_job {
+	uint8_t *raw;
+	int rawsz;
+	uint8_t *comp;
+	int compsz;
+};
+
+/** @brief The chunks a compression thread compresses: every stride'th from first. */
+struct compress_thread {
+	pthread_t thread;
+	struct chunk_job *jobs;
+	int njobs;
+	int first;
+	int stride;
+};
+
+static void *compress_thread_fn(void *arg)
+{
+	struct compress_thread *t = arg;
+
+	for (int i = t->first; i < t->njobs; i += t->stride) 
+		t->jobs[i].compsz = lz4_compress(t->jobs[i].raw, t->jobs[i].rawsz, t->jobs[i].comp);
+	return NULL;
+}
+
+/**
+ * @brief Compress the chunks of an item, a thread per host core.
+ * @return Whether successful.
+ */
+static bool compress_chunks(struct chunk_job *jobs, int njobs)
+{
+	long ncores = sysconf(_SC_NPROCESSORS_ONLN);
+	int nthreads = ncores < 1 ? 1 : ncores < njobs ? ncores : njobs;
+	struct compress_thread threads[nthreads];
+	int started, err = 0;
+
+	for (started = 0; started < nthreads; ++started) {
+		threads[started] = (struct compress_thread){ 
+			.jobs = jobs, .njobs = njobs, .first = started, .stride = nthreads 
+		};
+		err = pthread_create(&threads[started].thread, NULL, compress_thread_fn, 
+				     &threads[started]);
+		if (err) {
+			fprintf(stderr, "Error creating thread: %s\n", strerror(err));
+			break;
+		}
+	}
+	for (int i = 0; i < started; ++i)
+		pthread_join(threads[i].thread, NULL);
+	return !err;
+}
+
+/**
+ * @brief Compress an item's data into a sequence of struct lz4_chunk.
+ * @return The dynamically allocated compressed data, or NULL on error.
+ *
+ * @param[out] compsz_out Size of the compressed data in bytes
+ */
+static uint8_t *compress_item(uint8_t *data, int datasz, int *compsz_out)
+{
+	int njobs = (datasz+LZ4_CHUNKSZ-1)/LZ4_CHUNKSZ;
+	struct chunk_job *jobs;
+	uint8_t *comp = NULL, *out;
+	struct lz4_chunk *chunk;
+	int compsz = 0;
+
+	jobs = calloc(njobs, sizeof(struct chunk_job));
+	if (!jobs) {
+		fprintf(stderr, "Error allocating memory: %s\n", strerror(errno));
+		return NULL;
+	}
+	for (int i = 0; i < njobs; ++i) {
+		jobs[i].raw = data+i*LZ4_CHUNKSZ;
+		jobs[i].rawsz = i == njobs-1 ? datasz-i*LZ4_CHUNKSZ : LZ4_CHUNKSZ;
+		jobs[i].comp = malloc(LZ4_COMPRESS_BOUND(jobs[i].rawsz));
+		if (!jobs[i].comp) {
+			fprintf(stderr, "Error allocating memory: %s\n", strerror(errno));
+			goto compress_item_cleanup;
+		}
+	}
+	if (!compress_chunks(jobs, njobs))
+		goto compress_item_cleanup;
+
+	/* Store any chunk that didn't compress as is. */
+	for (int i = 0; i < njobs; ++i) {
+		if (jobs[i].compsz >= jobs[i].rawsz) {
+			memcpy(jobs[i].comp, jobs[i].raw, jobs[i].rawsz);
+			jobs[i].compsz = jobs[i].rawsz|LZ4_CHUNK_UNCOMPRESSED;
+		}
+		compsz += sizeof(struct lz4_chunk)+
+			  round_up_multiple(jobs[i].compsz&~LZ4_CHUNK_UNCOMPRESSED, 4);
+	}
+	comp = calloc(1, compsz);
+	if (!comp) {
+		fprintf(stderr, "Error allocating memory: %s\n", strerror(errno));
+		goto compress_item_cleanup;
+	}
+	out = comp;
+	for (int i = 0; i < njobs; ++i) {
+		chunk = (struct lz4_chunk *)out;
+		chunk->size = jobs[i].compsz;
+		memcpy(chunk->data, jobs[i].comp, jobs[i].compsz&~LZ4_CHUNK_UNCOMPRESSED);
+		out += sizeof(struct lz4_chunk)+
+		       round_up_multiple(jobs[i].compsz&~LZ4_CHUNK_UNCOMPRESSED, 4);
+	}
+	*compsz_out = compsz;
+
+compress_item_cleanup:
+	for (int i = 0; i < njobs; ++i)
+		freep(&jobs[i].comp);
+	freep(&jobs);
+	return comp;
+}
+
 /**
  * @brief Append the contents of a file as an item to the image.
  *
+ * @param compress Whether to store the file compressed, if that makes it smaller
+ *
  * @see image_append_item() for `img` param and return.
  */
-static struct image *image_append_file(struct image *img, char *fpath, enum item_id id)
+static struct image_v3 *image_append_file(struct image_v3 *img, char *fpath, enum item_id id,
+					  uint32_t load_addr, bool compress)
 {
 	char *file_contents;
-	int fsz;
+	uint8_t *comp = NULL;
+	int fsz, compsz;
 
 	file_contents = file_read(fpath, &fsz);
 	if (!file_contents) 
 		return NULL;
-	img = image_append_item(img, id, fsz, file_contents);
+	if (compress && fsz) {
+		comp = compress_item((uint8_t *)file_contents, fsz, &compsz);
+		if (!comp) {
+			freep(&file_contents);
+			return NULL;
+		}
+		printf("Compressed %s from %d to %d bytes\n", fpath, fsz, compsz);
+		if (compsz >= fsz) {
+			printf("Storing %s uncompressed as it didn't compress\n", fpath);
+			freep(&comp);
+		}
+	}
+	if (comp) 
+		img = image_append_item(img, id, load_addr, compsz, comp, fsz, ITEM_FLAG_LZ4);
+	else
+		img = image_append_item(img, id, load_addr, fsz, file_contents, fsz, 0);
+	freep(&comp);
 	freep(&file_contents);
 	return img;
 }
@@ -193,11 +351,13 @@ static bool file_write(char *fpath, char *mem, int n)
  * Same as image_append_file() but free the input image if the append fails
  * (the realloc() failing specifically but something else might have failed instead).
  */
-static struct image *image_append_file_free_on_fail(struct image *img, char *fpath, enum item_id id)
+static struct image_v3 *image_append_file_free_on_fail(struct image_v3 *img, char *fpath, 
+						       enum item_id id, uint32_t load_addr,
+						       bool compress)
 {
-	struct image *new_img; 
+	struct image_v3 *new_img; 
 	
-	new_img = image_append_file(img, fpath, id);
+	new_img = image_append_file(img, fpath, id, load_addr, compress);
 	if (!new_img)  {
 		freep(&img);
 		return NULL;
@@ -207,29 +367,29 @@ static struct image *image_append_file_free_on_fail(struct image *img, char *fpa
 
 /**
  * @brief Build an image out of a kernel and device tree blob files.
+ *
+ * @param compress Whether to store the files compressed
  */
-static struct image *build_image(char *kern_fpath, char *dtb_fpath)
+static struct image_v3 *build_image(char *kern_fpath, char *dtb_fpath, bool compress)
 {
-	struct image *img, *new_img;
+	struct image_v3 *img;
 
-	img = malloc(sizeof(struct image));
-	img->magic = IMG_MAGIC;
+	/* Zeroed so that the unused table of contents entries are zero. */
+	img = calloc(1, sizeof(struct image_v3));
+	if (!img) {
+		fprintf(stderr, "Error allocating memory: %s\n", strerror(errno));
+		return NULL;
+	}
+	img->magic = IMG_MAGIC_V3;
 	/* Set to its current size. As it grows this will be increased. */
-	img->imgsz = sizeof(struct image);
+	img->imgsz = sizeof(struct image_v3);
 
-	img = image_append_file_free_on_fail(img, kern_fpath, ITEM_ID_KERNEL);
+	img = image_append_file_free_on_fail(img, kern_fpath, ITEM_ID_KERNEL, KERN_RAM_ADDR,
+					     compress);
 	if (!img)  
 		return NULL;
-	img = image_append_file_free_on_fail(img, dtb_fpath, ITEM_ID_DEVICE_TREE_BLOB);
-	if (!img) 
-		return NULL;
-	/* Append terminating item. */
-	new_img = image_append_item(img, ITEM_ID_END, 0, NULL);
-	if (!new_img) {
-		freep(&img);
-		return NULL;
-	}
-	return new_img;
+	return image_append_file_free_on_fail(img, dtb_fpath, ITEM_ID_DEVICE_TREE_BLOB, 
+					      DTB_RAM_ADDR, compress);
 }
 
 /**
@@ -251,13 +411,19 @@ static bool any_arg_is_help(int argc, char *argv[])
 int main(int argc, char *argv[])
 {
 	char *part, *kern_fpath, *dtb_fpath;
-	struct image *img;
+	struct image_v3 *img;
+	bool compress = false;
 	int ret;
 
 	if (any_arg_is_help(argc, argv)) {
 		print_usage();
 		exit(EXIT_SUCCESS);
 	}
+	if (argc > 1 && (strcmp(argv[1], "-z") == 0 || strcmp(argv[1], "--lz4") == 0)) {
+		compress = true;
+		--argc;
+		++argv;
+	}
 	if (argc != 4) {
 		print_usage();
 		exit(EXIT_FAILURE);
@@ -266,7 +432,7 @@ int main(int argc, char *argv[])
 	kern_fpath = argv[2];
 	dtb_fpath = argv[3];
 
-	img = build_image(kern_fpath, dtb_fpath);
+	img = build_image(kern_fpath, dtb_fpath, compress);
 	if (!img)
 		exit(EXIT_FAILURE);
 
@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2023 Petar Turukalo
+ * SPDX-License-Identifier: GPL-2.0
+ *
+ * A greedy LZ4 block compressor: each position is looked up in a hash table
+ * of the last position its next 4 bytes were seen at, and the first match
+ * found is taken. This trades some ratio against the LZ4 reference's high
+ * compression mode for simplicity, and still produces standard LZ4 blocks.
+ */
+#include <string.h>
+#include "lz4.h"
+
+#define MIN_MATCH 4
+#define MAX_OFF 0xffff
+/* The last literals of a block can't be part of a match. */
+#define LAST_LITERALS 5
+/* A match can't start in the last this many bytes of a block. */
+#define MF_LIMIT 12
+#define TOKEN_LEN_MORE 15
+#define HASH_BITS 14
+
+static uint32_t read32(uint8_t *p)
+{
+	uint32_t n;
+
+	memcpy(&n, p, sizeof(n));
+	return n;
+}
+
+static uint32_t hash(uint32_t seq)
+{
+	return (seq*2654435761U)>>(32-HASH_BITS);
+}
+
+/** @brief Write the continuation of a token length field. */
+static uint8_t *write_len(uint8_t *out, int len)
+{
+	for (; len >= 255; len -= 255)
+		*out++ = 255;
+	*out++ = len;
+	return out;
+}
+
+/**
+ * @brief Write a sequence: literals, then a match of a length at an offset back,
+ *	  unless the length is 0, which makes it the last sequence of the block.
+ * @return Where to write the next sequence.
+ */
+static uint8_t *write_sequence(uint8_t *out, uint8_t *lit, int nlit, int off, int len)
+{
+	uint8_t *token = out++;
+
+	*token = (nlit < TOKEN_LEN_MORE ? nlit : TOKEN_LEN_MORE)<<4;
+	if (nlit >= TOKEN_LEN_MORE)
+		out = write_len(out, nlit-TOKEN_LEN_MORE);
+	memcpy(out, lit, nlit);
+	out += nlit;
+	if (!len)
+		return out;
+
+	*out++ = off;
+	*out++ = off>>8;
+	len -= MIN_MATCH;
+	*token |= len < TOKEN_LEN_MORE ? len : TOKEN_LEN_MORE;
+	if (len >= TOKEN_LEN_MORE)
+		out = write_len(out, len-TOKEN_LEN_MORE);
+	return out;
+}
+
+int lz4_compress(uint8_t *src, int srcsz, uint8_t *dest)
+{
+	int table[1<<HASH_BITS];
+	uint8_t *out = dest;
+	int anchor = 0, i = 0;
+	int ref, len;
+	uint32_t h;
+
+	memset(table, 0xff, sizeof(table));
+	while (i < srcsz-MF_LIMIT) {
+		h = hash(read32(src+i));
+		ref = table[h];
+		table[h] = i;
+		if (ref < 0 || i-ref > MAX_OFF || read32(src+ref) != read32(src+i)) {
+			++i;
+			continue;
+		}
+		len = MIN_MATCH;
+		while (i+len < srcsz-LAST_LITERALS && src[ref+len] == src[i+len])
+			++len;
+		out = write_sequence(out, src+anchor, i-anchor, i-ref, len);
+		i += len;
+		anchor = i;
+	}
+	out = write_sequence(out, src+anchor, srcsz-anchor, 0, 0);
+	return out-dest;
+}
@@ -0,0 +1,25 @@
+/*
+ * Copyright (C) 2023 Petar Turukalo
+ * SPDX-License-Identifier: GPL-2.0
+ *
+ * Compression into LZ4 blocks, which the bootloader decompresses.
+ */
+#ifndef LZ4_H
+#define LZ4_H
+
+#include <stdint.h>
+
+/* Size of a buffer large enough for any input of n bytes compressed. */
+#define LZ4_COMPRESS_BOUND(n) ((n)+(n)/255+16)
+
+/**
+ * @brief Compress data into an LZ4 block. Safe to call from more than one thread
+ *	  at once.
+ *
+ * @param dest Buffer of at least LZ4_COMPRESS_BOUND(srcsz) bytes
+ *
+ * @return Size of the compressed block in bytes.
+ */
+int lz4_compress(uint8_t *src, int srcsz, uint8_t *dest);
+
+#endif
@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) 2023 Petar Turukalo
+ * SPDX-License-Identifier: GPL-2.0
+ *
+ * Binary log record definitions shared between the bootloader and the log
+ * decoder. In binary log mode the bootloader sends a record per log message
+ * instead of formatting the message itself, and the decoder formats it on 
+ * the host, looking the format string up in the bootloader ELF.
+ */
+#ifndef BINLOG_H
+#define BINLOG_H
+
+/* 
+ * First byte of every record, which doesn't appear in text output, so records
+ * can be picked out of a capture that also has text in it.
+ */
+#define BINLOG_SYNC 0xb1
+
+/**
+ * @struct binlog_record
+ * @brief Header of a record. All fields are little-endian. 
+ *
+ * @var binlog_record::fmt_addr
+ * Address of the message's format string in the bootloader, which is where it is
+ * in the bootloader ELF's loaded sections.
+ *
+ * @var binlog_record::timestamp_us
+ * Time the message was logged at, in microseconds.
+ *
+ * @var binlog_record::args
+ * An argument for each conversion specifier in the format string, in order. 
+ * A u or x argument is its 32-bit value, and an s argument is the string's bytes
+ * including the null terminator.
+ */
+struct binlog_record {
+	uint8_t sync;
+	uint32_t fmt_addr;
+	uint32_t timestamp_us;
+	uint8_t args[];
+} __attribute__((packed));
+
+#endif
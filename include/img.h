@@ -11,7 +11,9 @@
 
 #include "sd_blksz.h"
 
-#define IMG_MAGIC 0xF00BA12
+#define IMG_MAGIC    0xF00BA12  /**< Magic of a version 1 image, see struct image. */
+#define IMG_MAGIC_V2 0xF00BA13  /**< Magic of a version 2 image, see struct image_v2. */
+#define IMG_MAGIC_V3 0xF00BA14  /**< Magic of a version 3 image, see struct image_v3. */
 
 enum item_id {
 	ITEM_ID_END,  /**< First so that it has value 0. */
@@ -70,4 +72,148 @@ struct image {
 	struct item items[];
 } __attribute__((aligned(SD_BLKSZ)));
 
+/**
+ * @struct toc_entry_v2
+ * @brief Table of contents entry locating an item in a version 2 image.
+ *
+ * @var toc_entry_v2::id
+ * Enum item_id identifier for what the item stores.
+ *
+ * @var toc_entry_v2::lba
+ * Offset of the start of the item's data from the start of the image, in blocks.
+ *
+ * @var toc_entry_v2::datasz
+ * Size of the item's data in bytes, not including the padding up to the end of 
+ * its last block.
+ *
+ * @var toc_entry_v2::load_addr
+ * Address in RAM the item's data is loaded to.
+ *
+ * @var toc_entry_v2::flags
+ * How the item's data is stored. No flags are defined for version 2, so this 
+ * shall be 0.
+ */
+struct toc_entry_v2 {
+	uint32_t id;
+	uint32_t lba;
+	uint32_t datasz;
+	uint32_t load_addr;
+	uint32_t flags;
+};
+
+/* Number of table of contents entries that fit in the version 2 image head block. */
+#define IMG_TOC_V2_NENTRIES ((SD_BLKSZ-3*sizeof(uint32_t))/sizeof(struct toc_entry_v2))
+
+/**
+ * @struct image_v2
+ * Version 2 of an image. Where a version 1 image chains its items so that each has
+ * to be read to find the next, this has a table of contents in its first block,
+ * so that the bootloader knows where all of the items are up front and can read 
+ * each in a single read straight to where it's loaded.
+ *
+ * @var image_v2::magic 
+ * Has value IMG_MAGIC_V2. The magic and image size are where they are in a 
+ * version 1 image, so either version is validated the same way.
+ *
+ * @var image_v2::imgsz 
+ * Size of the entire image in bytes.
+ *
+ * @var image_v2::nentries
+ * Number of the entries in the table of contents that are used.
+ *
+ * @var image_v2::toc
+ * Table of contents. Each item's data follows the image head, starting at the start
+ * of a block and padded to the end of its last block, with no item header before 
+ * it and no end item terminating the items.
+ */
+struct image_v2 {
+	uint32_t magic;
+	uint32_t imgsz;
+	uint32_t nentries;
+	struct toc_entry_v2 toc[IMG_TOC_V2_NENTRIES];
+} __attribute__((aligned(SD_BLKSZ)));
+
+_Static_assert(sizeof(struct image_v2) == SD_BLKSZ, "version 2 image head isn't a block");
+
+/**
+ * @struct toc_entry
+ * @brief Table of contents entry locating an item in a version 3 image. The same 
+ *	  as a version 2 entry, with the raw size added at the end.
+ *
+ * @var toc_entry::flags
+ * Enum item_flags, how the item's data is stored.
+ *
+ * @var toc_entry::rawsz
+ * Size of the item's data once loaded into RAM in bytes. The same as the data size
+ * unless the data is compressed.
+ *
+ * @see toc_entry_v2 for the other fields, where toc_entry_v2::datasz is the size
+ *	of the item's data as stored in the image.
+ */
+struct toc_entry {
+	uint32_t id;
+	uint32_t lba;
+	uint32_t datasz;
+	uint32_t load_addr;
+	uint32_t flags;
+	uint32_t rawsz;
+};
+
+enum item_flags {
+	/** 
+	 * The data is compressed: a sequence of struct lz4_chunk, each compressed 
+	 * independently of the others. 
+	 */
+	ITEM_FLAG_LZ4 = 0x1
+};
+
+/* 
+ * Size of the data each chunk of a compressed item decompresses to, apart from the 
+ * last, which decompresses to what's left of the raw size. Chunk n decompresses to
+ * the load address plus n times this.
+ */
+#define LZ4_CHUNKSZ 0x10000  /* 64 KiB. */
+/* Set in the size of a chunk whose data is stored uncompressed. */
+#define LZ4_CHUNK_UNCOMPRESSED 0x80000000
+
+/**
+ * @struct lz4_chunk
+ * @brief A chunk of the data of a compressed item.
+ *
+ * @var lz4_chunk::size
+ * Size of the data field in bytes, not including padding, ORed with 
+ * LZ4_CHUNK_UNCOMPRESSED if it didn't compress.
+ *
+ * @var lz4_chunk::data
+ * The chunk compressed as an LZ4 block (the LZ4 block format without the LZ4 
+ * frame format around it), or the chunk as is. Padded to a multiple of 4 bytes 
+ * so the next chunk's size is aligned.
+ */
+struct lz4_chunk {
+	uint32_t size;
+	uint8_t data[];
+};
+
+/* Number of table of contents entries that fit in the version 3 image head block. */
+#define IMG_TOC_NENTRIES ((SD_BLKSZ-3*sizeof(uint32_t))/sizeof(struct toc_entry))
+
+/**
+ * @struct image_v3
+ * Version 3 of an image: a version 2 image whose table of contents entries have
+ * a raw size, so that items can be stored compressed.
+ *
+ * @var image_v3::magic 
+ * Has value IMG_MAGIC_V3.
+ *
+ * @see image_v2 for the other fields.
+ */
+struct image_v3 {
+	uint32_t magic;
+	uint32_t imgsz;
+	uint32_t nentries;
+	struct toc_entry toc[IMG_TOC_NENTRIES];
+} __attribute__((aligned(SD_BLKSZ)));
+
+_Static_assert(sizeof(struct image_v3) == SD_BLKSZ, "version 3 image head isn't a block");
+
 #endif
@@ -0,0 +1,217 @@
+/*
+ * Copyright (C) 2023 Petar Turukalo
+ * SPDX-License-Identifier: GPL-2.0
+ *
+ * Decode a capture of the bootloader's binary log, see binlog.h, back into
+ * the text the bootloader would have logged in text mode.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <stdint.h>
+#include <elf.h>
+#include "binlog.h"
+
+static void print_usage(void)
+{
+	printf("Usage: 'logdec <elf> [<capture>]' where <elf> is the bootloader ELF,\n"
+	       "bld/bootloader.elf, built with the binary log mode that produced\n"
+	       "<capture>, the bytes received over serial. The capture is read from\n"
+	       "stdin if not given. Text in the capture outside of binary records is\n"
+	       "passed through as is.\n"
+	       "\n"
+	       "Use arg -h or --help to print this message again.\n");
+}
+
+/**
+ * @brief Read the whole of a file into a dynamically allocated buffer.
+ * @return NULL on error
+ */
+static char *file_read(FILE *f, char *fpath, long *fsz_out)
+{
+	char *mem = NULL;
+	long n = 0, cap = 0;
+	size_t nread;
+
+	do {
+		if (n == cap) {
+			cap = cap ? cap*2 : 4096;
+			mem = realloc(mem, cap);
+			if (!mem) {
+				fprintf(stderr, "Error allocating memory: %s\n", strerror(errno));
+				return NULL;
+			}
+		}
+		nread = fread(mem+n, 1, cap-n, f);
+		n += nread;
+	} while (nread);
+	if (ferror(f)) {
+		fprintf(stderr, "Error reading from file %s: %s\n", fpath, strerror(errno));
+		free(mem);
+		return NULL;
+	}
+	*fsz_out = n;
+	return mem;
+}
+
+/**
+ * @brief Get the null terminated string at an address in the bootloader, from the 
+ *	  ELF section loaded there.
+ * @return NULL if no section has the address
+ */
+static char *elf_string_at(char *elf, long elfsz, uint32_t addr)
+{
+	Elf32_Ehdr *ehdr = (Elf32_Ehdr *)elf;
+	Elf32_Shdr *shdr;
+
+	for (int i = 0; i < ehdr->e_shnum; ++i) {
+		shdr = (Elf32_Shdr *)(elf+ehdr->e_shoff+i*ehdr->e_shentsize);
+		if (shdr->sh_type != SHT_PROGBITS || !(shdr->sh_flags&SHF_ALLOC))
+			continue;
+		if (addr >= shdr->sh_addr && addr < shdr->sh_addr+shdr->sh_size &&
+		    shdr->sh_offset+shdr->sh_size <= elfsz)
+			return elf+shdr->sh_offset+(addr-shdr->sh_addr);
+	}
+	return NULL;
+}
+
+static bool elf_valid(char *elf, long elfsz)
+{
+	Elf32_Ehdr *ehdr = (Elf32_Ehdr *)elf;
+
+	return elfsz >= (long)sizeof(Elf32_Ehdr) && !memcmp(ehdr->e_ident, ELFMAG, SELFMAG) &&
+	       ehdr->e_ident[EI_CLASS] == ELFCLASS32 && 
+	       ehdr->e_shoff+(long)ehdr->e_shnum*ehdr->e_shentsize <= elfsz;
+}
+
+static uint32_t get_le32(uint8_t *p)
+{
+	return p[0] | p[1]<<8 | p[2]<<16 | (uint32_t)p[3]<<24;
+}
+
+/**
+ * @brief Print a record's message, formatting its format string the same way the
+ *	  bootloader's Vsnprintf() does.
+ * @return The number of argument bytes used, or -1 if the record is cut short.
+ */
+static long print_message(char *fmt, uint32_t timestamp_us, uint8_t *args, long nargs)
+{
+	long used = 0;
+	int width;
+	char pad;
+	size_t len;
+
+	printf("[%10u] ", timestamp_us);
+	for (; *fmt; ++fmt) {
+		if (*fmt != '%') {
+			putchar(*fmt);
+			continue;
+		}
+		pad = *++fmt == '0' ? '0' : ' ';
+		width = strtol(fmt, &fmt, 10);
+		switch (*fmt) {
+			case 'u':
+			case 'x':
+				if (used+4 > nargs)
+					return -1;
+				if (*fmt == 'x')
+					printf(pad == '0' ? "0x%0*x" : "0x%*x", width, get_le32(args+used));
+				else
+					printf(pad == '0' ? "%0*u" : "%*u", width, get_le32(args+used));
+				used += 4;
+				break;
+			case 's':
+				len = strnlen((char *)args+used, nargs-used);
+				if (used+(long)len >= nargs)
+					return -1;
+				printf("%s", args+used);
+				used += len+1;
+				break;
+			default:
+				printf("<bad conversion specifier %c>", *fmt);
+				return used;
+		}
+	}
+	printf("\r\n");
+	return used;
+}
+
+/** @brief Decode a capture, printing the text it decodes to. */
+static void decode(char *elf, long elfsz, uint8_t *cap, long capsz)
+{
+	struct binlog_record *rec;
+	char *fmt;
+	long i = 0, used;
+
+	while (i < capsz) {
+		rec = (struct binlog_record *)(cap+i);
+		if (cap[i] != BINLOG_SYNC || i+(long)sizeof(*rec) > capsz) {
+			putchar(cap[i++]);
+			continue;
+		}
+		fmt = elf_string_at(elf, elfsz, rec->fmt_addr);
+		if (!fmt) {
+			/* Not a record after all. */
+			putchar(cap[i++]);
+			continue;
+		}
+		used = print_message(fmt, rec->timestamp_us, rec->args, 
+				     capsz-i-sizeof(*rec));
+		if (used == -1) {
+			fprintf(stderr, "Capture ends partway through a record\n");
+			return;
+		}
+		i += sizeof(*rec)+used;
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	char *elf, *cap, *cappath = "stdin";
+	long elfsz, capsz;
+	FILE *f;
+	int ret = EXIT_FAILURE;
+
+	if (argc < 2 || argc > 3 || !strcmp(argv[1], "-h") || !strcmp(argv[1], "--help")) {
+		print_usage();
+		return argc == 2 ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+	f = fopen(argv[1], "rb");
+	if (!f) {
+		fprintf(stderr, "Error opening file %s for reading: %s\n", argv[1], strerror(errno));
+		return EXIT_FAILURE;
+	}
+	elf = file_read(f, argv[1], &elfsz);
+	fclose(f);
+	if (!elf)
+		return EXIT_FAILURE;
+	if (!elf_valid(elf, elfsz)) {
+		fprintf(stderr, "Error: %s isn't a 32-bit ELF\n", argv[1]);
+		goto main_cleanup0;
+	}
+
+	f = stdin;
+	if (argc == 3) {
+		cappath = argv[2];
+		f = fopen(cappath, "rb");
+		if (!f) {
+			fprintf(stderr, "Error opening file %s for reading: %s\n", 
+				cappath, strerror(errno));
+			goto main_cleanup0;
+		}
+	}
+	cap = file_read(f, cappath, &capsz);
+	if (f != stdin)
+		fclose(f);
+	if (!cap)
+		goto main_cleanup0;
+
+	decode(elf, elfsz, (uint8_t *)cap, capsz);
+	ret = EXIT_SUCCESS;
+	free(cap);
+main_cleanup0:
+	free(elf);
+	return ret;
+}